@@ -225,6 +225,17 @@ _gdb_objc_messenger_breakpoints:
 #define method_name 	0
 #define method_imp 	16
 
+// Keep in sync with SUPPORT_CACHE_READER_EPOCHS in objc-config.h.
+#if OBJC_CACHE_READER_EPOCHS
+#   define CACHE_READER_EPOCHS 1
+#else
+#   define CACHE_READER_EPOCHS 0
+#endif
+
+// Thread-specific data slot holding this thread's cache_reader_t.
+// This is __PTK_FRAMEWORK_OBJC_KEY6 * 8. Must match CACHE_READER_KEY.
+#define CACHE_READER_TSD	368
+
 
 //////////////////////////////////////////////////////////////////////
 //
@@ -300,10 +311,53 @@ LExit$0:
 //	    (found) calls or returns IMP in r11, eq/ne set for forwarding
 //	    (not found) jumps to LCacheMiss, class still in r10
 //
+// With CACHE_READER_EPOCHS the lookup runs inside this thread's cache 
+// reader critical section so the cache collector does not free the 
+// buckets while we read them.
+// The reader's generation is odd inside the critical section.
+// A thread with no cache reader record always misses.
+// See "Cache reader generations" in objc-cache.mm.
+//
 /////////////////////////////////////////////////////////////////////
 
 .macro CacheHit
 
+#if CACHE_READER_EPOCHS
+
+	// r11 = found bucket
+	movq	8(%r11), %r11		// r11 = imp
+
+	// Last bucket read is done. Leave the critical section.
+	movq	%gs:CACHE_READER_TSD, %r10
+	incq	(%r10)			// reader->generation++
+
+.if $1 == GETIMP
+	movq	%r11, %rax		// return imp
+	ret
+
+.else
+
+.if $0 != STRET
+	cmp	%r11, %r11		// set eq for nonstret forwarding
+.else
+	test	%r11, %r11		// set ne for stret forwarding
+.endif
+
+.if $1 == CALL
+	MESSENGER_END_FAST
+	jmp	*%r11			// call imp
+	
+.elseif $1 == LOOKUP
+	ret				// return imp in r11
+	
+.else
+.abort oops
+.endif
+
+.endif
+
+#else
+
 	// CacheHit must always be preceded by a not-taken `jne` instruction
 	// in order to set the correct flags for _objc_msgForward_impcache.
 
@@ -335,10 +389,20 @@ LExit$0:
 
 .endif
 
+#endif
+
 .endmacro
 
 
 .macro	CacheLookup
+#if CACHE_READER_EPOCHS
+	// Enter the cache reader critical section.
+	movq	%gs:CACHE_READER_TSD, %r11
+	testq	%r11, %r11
+	jz	LCacheMiss_f		// no cache reader record: miss
+	incq	(%r11)			// reader->generation++
+
+#endif
 .if $0 != STRET
 	movq	%a2, %r11		// r11 = _cmd
 .else
@@ -375,7 +439,7 @@ LExit$0:
 
 3:
 	// wrap or miss
-	jb	LCacheMiss_f		// if (bucket->sel < 1) cache miss
+	jb	5f			// if (bucket->sel < 1) cache miss
 	// wrap
 	movq	8(%r11), %r11		// bucket->imp is really first bucket
 	jmp 	2f
@@ -401,6 +465,12 @@ LExit$0:
 
 3:
 	// double wrap or miss
+5:
+#if CACHE_READER_EPOCHS
+	// miss: leave the critical section
+	movq	%gs:CACHE_READER_TSD, %r11
+	incq	(%r11)			// reader->generation++
+#endif
 	jmp	LCacheMiss_f
 
 .endmacro
@@ -698,7 +768,7 @@ LCacheMiss:
  * objc_msgLookup ABI:
  * IMP returned in r11
  * Forwarding returned in Z flag
- * r10 reserved for our use but not used
+ * r10 reserved for our use (CACHE_READER_EPOCHS)
  *
  ********************************************************************/
 	
@@ -39,6 +39,7 @@
 #include <libkern/OSAtomic.h>
 #include <Block.h>
 #include <map>
+#include <algorithm>
 #include <execinfo.h>
 
 @interface NSInvocation
@@ -136,13 +137,55 @@ namespace {
 // don't want the table to act as a root for `leaks`.
 typedef objc::DenseMap<DisguisedPtr<objc_object>,size_t,true> RefcountMap;
 
+#if SUPPORT_BIASED_REFCOUNTS
+// Objects biased to a thread (OBJC_BIASED_REFCOUNTS), with the 
+// releases by other threads that the owner has yet to merge.
+struct biased_rc_t {
+    biased_rc_table_t *owner;
+    size_t debt;
+};
+typedef objc::DenseMap<DisguisedPtr<objc_object>,biased_rc_t> BiasedMap;
+#endif
+
+#if SUPPORT_NONPOINTER_ISA
+// Retain counts that overflowed a nonpointer isa. 
+// See "Side table overflow slots" below.
+struct overflow_slot_t {
+    uintptr_t key;   // disguised object; 0 if free
+    uint64_t word;   // count << OVERFLOW_COUNT_SHIFT | borrows in flight
+};
+
+enum { OverflowSlotCount = 16 };
+#define OVERFLOW_COUNT_SHIFT 16
+#define OVERFLOW_INFLIGHT_MASK ((1ULL<<OVERFLOW_COUNT_SHIFT)-1)
+#define OVERFLOW_PINNED (1ULL<<63)
+
+// Lock-free weak loads in progress on one side table. See beginWeakLoad().
+// Kept on its own cache line so that loads don't write to the lock's.
+struct alignas(64) weak_load_gate_t {
+    volatile uint32_t phase;       // which counter new loads use
+    volatile uint32_t loaders[2];  // loads in progress, by phase
+};
+#endif
+
 struct SideTable {
     spinlock_t slock;
     RefcountMap refcnts;
     weak_table_t weak_table;
+#if SUPPORT_BIASED_REFCOUNTS
+    BiasedMap biased;
+#endif
+#if SUPPORT_NONPOINTER_ISA
+    overflow_slot_t * volatile overflow;  // OverflowSlotCount slots, or nil
+    weak_load_gate_t weakLoads;
+#endif
 
     SideTable() {
         memset(&weak_table, 0, sizeof(weak_table));
+#if SUPPORT_NONPOINTER_ISA
+        overflow = nil;
+        memset(&weakLoads, 0, sizeof(weakLoads));
+#endif
     }
 
     ~SideTable() {
@@ -152,6 +195,42 @@ struct SideTable {
     void lock() { slock.lock(); }
     void unlock() { slock.unlock(); }
 
+#if SUPPORT_NONPOINTER_ISA
+    // objc_loadWeakRetained() reads a weakly-referenced object 
+    // without the lock between beginWeakLoad() and endWeakLoad().
+    // A deallocating object's thread calls waitForWeakLoads() with 
+    // the lock held, after clearing its weak references and before 
+    // the object is freed. Loads that begin after the clear find 
+    // the reference gone, so only earlier loads are waited for: 
+    // the waiter flips the phase, and new loads count in the other 
+    // counter instead of holding it up.
+    unsigned int beginWeakLoad() {
+        unsigned int phase = weakLoads.phase;
+        __sync_fetch_and_add(&weakLoads.loaders[phase], 1);
+        return phase;
+    }
+    void endWeakLoad(unsigned int phase) {
+        __sync_fetch_and_sub(&weakLoads.loaders[phase], 1);
+    }
+    void waitForWeakLoads() {
+        OSMemoryBarrier();
+        unsigned int phase = weakLoads.phase;
+        // Loads still counted in the other phase began before the 
+        // last flip. Drain them, then flip and drain this phase.
+        waitForWeakLoaders(phase ^ 1);
+        if (weakLoads.loaders[phase] == 0) return;
+        weakLoads.phase = phase ^ 1;
+        OSMemoryBarrier();
+        waitForWeakLoaders(phase);
+    }
+    void waitForWeakLoaders(unsigned int phase) {
+        for (unsigned int spins = 0; weakLoads.loaders[phase] != 0; spins++) {
+            if (spins < 100) spin_pause();
+            else sched_yield();
+        }
+    }
+#endif
+
     // Address-ordered lock discipline for a pair of side tables.
 
     template<bool HaveOld, bool HaveNew>
@@ -197,21 +276,111 @@ void SideTable::unlockTwo<false, true>(SideTable *, SideTable *lock2) {
 // libc calls us before our C++ initializers run. We also don't want a global 
 // pointer to this struct because of the extra indirection.
 // Do it the hard way.
-alignas(StripedMap<SideTable>) static uint8_t 
-    SideTableBuf[sizeof(StripedMap<SideTable>)];
+//
+// The stripe count scales with the number of CPUs so that many threads 
+// retaining and releasing different objects rarely share a lock. 
+// SIDE_TABLE_STRIPE_COUNT_LOG2 bounds it; the StripedMap default is 
+// the minimum.
+#if TARGET_OS_EMBEDDED
+#   define SIDE_TABLE_STRIPE_COUNT_LOG2 6
+#else
+#   define SIDE_TABLE_STRIPE_COUNT_LOG2 9
+#endif
+#define SIDE_TABLE_STRIPES_PER_CPU 4
+
+typedef StripedMap<SideTable, SIDE_TABLE_STRIPE_COUNT_LOG2> SideTableMap;
+
+alignas(SideTableMap) static uint8_t SideTableBuf[sizeof(SideTableMap)];
 
 static void SideTableInit() {
-    new (SideTableBuf) StripedMap<SideTable>();
+    new (SideTableBuf) SideTableMap();
+
+    unsigned int count = 1 << STRIPED_MAP_DEFAULT_COUNT_LOG2;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu > 0  &&  ncpu * SIDE_TABLE_STRIPES_PER_CPU > count) {
+        count = (unsigned int)MIN(ncpu * SIDE_TABLE_STRIPES_PER_CPU, 
+                                  1 << SIDE_TABLE_STRIPE_COUNT_LOG2);
+    }
+    reinterpret_cast<SideTableMap*>(SideTableBuf)->setStripeCount(count);
 }
 
-static StripedMap<SideTable>& SideTables() {
-    return *reinterpret_cast<StripedMap<SideTable>*>(SideTableBuf);
+static SideTableMap& SideTables() {
+    return *reinterpret_cast<SideTableMap*>(SideTableBuf);
 }
 
 // anonymous namespace
 };
 
 
+void sidetable_visitLocks(spinlock_visitor_t visitor, void *context)
+{
+    SideTableMap& tables = SideTables();
+    for (unsigned int i = 0; i < tables.stripeCount(); i++) {
+        visitor("SideTable", i, tables.stripeAt(i).slock, context);
+    }
+}
+
+
+/***********************************************************************
+* objc_copyWeakTableStatistics
+* Returns a malloc'd array of weak table statistics, one per side table.
+* Locking: acquires each side table lock in turn
+**********************************************************************/
+objc_weak_table_statistics_t *
+objc_copyWeakTableStatistics(unsigned int *outCount)
+{
+    SideTableMap& tables = SideTables();
+    unsigned int count = tables.stripeCount();
+    objc_weak_table_statistics_t *result = (objc_weak_table_statistics_t *)
+        calloc(count, sizeof(*result));
+
+    for (unsigned int i = 0; i < count; i++) {
+        SideTable& table = tables.stripeAt(i);
+        weak_table_stats_t stats;
+        table.lock();
+        weak_table_stats_no_lock(&table.weak_table, &stats);
+        table.unlock();
+
+        objc_weak_table_statistics_t& out = result[i];
+        out.stripe = i;
+        out.entries = stats.entries;
+        out.capacity = stats.capacity;
+        out.referrers = stats.referrers;
+        out.tableBytes = stats.table_bytes;
+        out.outOfLineEntries = stats.out_of_line_entries;
+        out.outOfLineBytes = stats.out_of_line_bytes;
+        out.loadFactor = 
+            stats.capacity ? (double)stats.entries / stats.capacity : 0;
+        out.maxDisplacement = stats.max_displacement;
+        out.maxReferrerDisplacement = stats.max_referrer_displacement;
+    }
+
+    if (outCount) *outCount = count;
+    return result;
+}
+
+
+/***********************************************************************
+* objc_compactWeakTables
+* Shrinks every side table's weak table and out-of-line referrer sets 
+* to fit. Returns the number of bytes freed.
+* Locking: acquires each side table lock in turn
+**********************************************************************/
+size_t
+objc_compactWeakTables(void)
+{
+    SideTableMap& tables = SideTables();
+    size_t freed = 0;
+    for (unsigned int i = 0; i < tables.stripeCount(); i++) {
+        SideTable& table = tables.stripeAt(i);
+        table.lock();
+        freed += weak_compact_no_lock(&table.weak_table);
+        table.unlock();
+    }
+    return freed;
+}
+
+
 //
 // The -fobjc-arc flag causes the compiler to issue calls to objc_{retain/release/autorelease/retain_block}
 //
@@ -465,6 +634,23 @@ objc_loadWeakRetained(id *location)
     if (obj->isTaggedPointer()) return obj;
     
     table = &SideTables()[obj];
+
+#if SUPPORT_NONPOINTER_ISA
+    // Lock-free fast case. If *location still holds obj once this 
+    // load is announced, then obj's weak references have not been 
+    // cleared yet, and its deallocating thread will wait for this 
+    // load before freeing it. Retaining a deallocating object fails.
+    {
+        bool handled = false;
+        bool retained = false;
+        unsigned int phase = table->beginWeakLoad();
+        if (*location == obj  &&  !obj->ISA()->hasCustomRR()) {
+            handled = obj->rootTryRetain_lockFree(retained);
+        }
+        table->endWeakLoad(phase);
+        if (handled) return retained ? obj : nil;
+    }
+#endif
     
     table->lock();
     if (*location != obj) {
@@ -565,6 +751,364 @@ objc_moveWeak(id *dst, id *src)
 }
 
 
+/***********************************************************************
+* Weak arrays
+* An objc_weakarray_t is a growable array of __weak slots. The slots 
+* live in fixed-size chunks so their addresses, which the weak table 
+* records, never change. Appending and destroying register and 
+* unregister referrers in batches, and snapshots retain the objects 
+* in batches, taking each side table lock once per batch instead of 
+* once per slot.
+* A weak array is not thread-safe itself. As with any __weak variable, 
+* a slot is set to nil from any thread when its object deallocates.
+**********************************************************************/
+
+enum { WeakArrayChunkSize = 128 };
+enum { WeakArrayBatchCount = 256 };
+
+struct weak_array_chunk_t {
+    weak_array_chunk_t *next;
+    weak_array_chunk_t *prev;
+    size_t count;  // slots in use
+    id slots[WeakArrayChunkSize];
+};
+
+struct objc_weakarray {
+    weak_array_chunk_t *first;
+    weak_array_chunk_t *last;
+    size_t count;  // slots in use, including nil slots
+
+    // Where objc_weakarray_compact() resumes looking for nil slots.
+    weak_array_chunk_t *cursorChunk;
+    size_t cursor;
+};
+
+struct weak_batch_entry_t {
+    SideTable *table;
+    objc_object *obj;
+    id *slot;
+    size_t index;  // snapshot position, for weak_array_retain_flush()
+
+    bool operator < (const weak_batch_entry_t& other) const {
+        return table < other.table;
+    }
+};
+
+
+// Registers or unregisters each slot, locking each side table once.
+static void 
+weak_array_flush(weak_batch_entry_t *batch, size_t count, bool registering)
+{
+    std::sort(batch, batch + count);
+
+    SideTable *locked = nil;
+    for (size_t i = 0; i < count; i++) {
+        weak_batch_entry_t& entry = batch[i];
+        if (entry.table != locked) {
+            if (locked) locked->unlock();
+            locked = entry.table;
+            locked->lock();
+        }
+
+        if (registering) {
+            objc_object *obj = (objc_object *)
+                weak_register_no_lock(&entry.table->weak_table, 
+                                      (id)entry.obj, entry.slot, false);
+            if (obj) obj->setWeaklyReferenced_nolock();
+            *entry.slot = (id)obj;
+        } 
+        else if (*entry.slot == (id)entry.obj) {
+            // Otherwise the object was deallocated and the slot cleared.
+            weak_unregister_no_lock(&entry.table->weak_table, 
+                                    (id)entry.obj, entry.slot);
+            *entry.slot = nil;
+        }
+    }
+    if (locked) locked->unlock();
+}
+
+
+// Stores the retained object of each slot, or nil, into result[index], 
+// locking each side table once. Objects with custom RR are retained 
+// with objc_loadWeakRetained() once no lock is held, because 
+// -retainWeakReference may need +initialize.
+static void 
+weak_array_retain_flush(weak_batch_entry_t *batch, size_t count, id *result)
+{
+    std::sort(batch, batch + count);
+
+    size_t customCount = 0;
+    SideTable *locked = nil;
+    for (size_t i = 0; i < count; i++) {
+        weak_batch_entry_t& entry = batch[i];
+        if (entry.table != locked) {
+            if (locked) locked->unlock();
+            locked = entry.table;
+            locked->lock();
+        }
+
+        id obj = nil;
+        // Otherwise the object was deallocated and the slot cleared.
+        // The lock keeps the object from being freed meanwhile.
+        if (*entry.slot == (id)entry.obj) {
+            if (entry.obj->ISA()->hasCustomRR()) {
+                batch[customCount++] = entry;
+            } else if (entry.obj->rootTryRetain()) {
+                obj = (id)entry.obj;
+            }
+        }
+        result[entry.index] = obj;
+    }
+    if (locked) locked->unlock();
+
+    for (size_t i = 0; i < customCount; i++) {
+        result[batch[i].index] = objc_loadWeakRetained(batch[i].slot);
+    }
+}
+
+
+static id *
+weak_array_push(objc_weakarray_t array)
+{
+    weak_array_chunk_t *chunk = array->last;
+    if (!chunk  ||  chunk->count == WeakArrayChunkSize) {
+        chunk = (weak_array_chunk_t *)calloc(1, sizeof(weak_array_chunk_t));
+        chunk->prev = array->last;
+        if (array->last) array->last->next = chunk;
+        else array->first = chunk;
+        array->last = chunk;
+    }
+    array->count++;
+    return &chunk->slots[chunk->count++];
+}
+
+
+// Removes the last slot, which must be nil.
+static void
+weak_array_pop(objc_weakarray_t array)
+{
+    weak_array_chunk_t *chunk = array->last;
+    assert(chunk->slots[chunk->count-1] == nil);
+    array->count--;
+    if (--chunk->count > 0) return;
+
+    array->last = chunk->prev;
+    if (array->last) array->last->next = nil;
+    else array->first = nil;
+    if (array->cursorChunk == chunk) array->cursorChunk = nil;
+    free(chunk);
+}
+
+
+// Moves the weak reference in src to the nil slot dst.
+static void
+weak_array_move(id *dst, id *src)
+{
+    objc_object *obj;
+    SideTable *table;
+
+ retry:
+    obj = (objc_object *)*src;
+    if (!obj) return;
+    if (obj->isTaggedPointer()) {
+        *dst = (id)obj;
+        *src = nil;
+        return;
+    }
+
+    table = &SideTables()[obj];
+    table->lock();
+    if (*src != (id)obj) {
+        table->unlock();
+        goto retry;
+    }
+    // nil if obj is already deallocating
+    *dst = weak_register_no_lock(&table->weak_table, (id)obj, dst, false);
+    weak_unregister_no_lock(&table->weak_table, (id)obj, src);
+    *src = nil;
+    table->unlock();
+}
+
+
+objc_weakarray_t
+objc_weakarray_create(void)
+{
+    return (objc_weakarray_t)calloc(1, sizeof(struct objc_weakarray));
+}
+
+
+void
+objc_weakarray_destroy(objc_weakarray_t array)
+{
+    if (!array) return;
+
+    weak_batch_entry_t batch[WeakArrayBatchCount];
+    size_t batchCount = 0;
+
+    for (weak_array_chunk_t *chunk = array->first; chunk; chunk = chunk->next) {
+        for (size_t i = 0; i < chunk->count; i++) {
+            objc_object *obj = (objc_object *)chunk->slots[i];
+            if (!obj  ||  obj->isTaggedPointer()) continue;
+            batch[batchCount].table = &SideTables()[obj];
+            batch[batchCount].obj = obj;
+            batch[batchCount].slot = &chunk->slots[i];
+            if (++batchCount == WeakArrayBatchCount) {
+                weak_array_flush(batch, batchCount, false);
+                batchCount = 0;
+            }
+        }
+    }
+    if (batchCount) weak_array_flush(batch, batchCount, false);
+
+    weak_array_chunk_t *chunk = array->first;
+    while (chunk) {
+        weak_array_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(array);
+}
+
+
+void
+objc_weakarray_append(objc_weakarray_t array, id *objects, size_t count)
+{
+    // Prevent a deadlock between the weak reference machinery
+    // and the +initialize machinery, as storeWeak() does.
+    // No side table lock is held here.
+    for (size_t i = 0; i < count; i++) {
+        objc_object *obj = (objc_object *)objects[i];
+        if (!obj  ||  obj->isTaggedPointer()) continue;
+        Class cls = obj->getIsa();
+        if (!((objc_class *)cls)->isInitialized()) {
+            _class_initialize(_class_getNonMetaClass(cls, (id)obj));
+        }
+    }
+
+    weak_batch_entry_t batch[WeakArrayBatchCount];
+    size_t batchCount = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        objc_object *obj = (objc_object *)objects[i];
+        id *slot = weak_array_push(array);
+        if (!obj  ||  obj->isTaggedPointer()) {
+            *slot = (id)obj;
+            continue;
+        }
+        batch[batchCount].table = &SideTables()[obj];
+        batch[batchCount].obj = obj;
+        batch[batchCount].slot = slot;
+        if (++batchCount == WeakArrayBatchCount) {
+            weak_array_flush(batch, batchCount, true);
+            batchCount = 0;
+        }
+    }
+    if (batchCount) weak_array_flush(batch, batchCount, true);
+}
+
+
+size_t
+objc_weakarray_count(objc_weakarray_t array)
+{
+    return array->count;
+}
+
+
+size_t
+objc_weakarray_snapshot(objc_weakarray_t array, id **outObjects)
+{
+    id *result = nil;
+    size_t count = 0;
+
+    if (array->count > 0) {
+        result = (id *)malloc(array->count * sizeof(id));
+
+        weak_batch_entry_t batch[WeakArrayBatchCount];
+        size_t batchCount = 0;
+        size_t index = 0;
+
+        for (weak_array_chunk_t *chunk = array->first; 
+             chunk; 
+             chunk = chunk->next) 
+        {
+            for (size_t i = 0; i < chunk->count; i++) {
+                objc_object *obj = (objc_object *)chunk->slots[i];
+                if (!obj) continue;
+                if (obj->isTaggedPointer()) {
+                    result[index++] = (id)obj;
+                    continue;
+                }
+                batch[batchCount].table = &SideTables()[obj];
+                batch[batchCount].obj = obj;
+                batch[batchCount].slot = &chunk->slots[i];
+                batch[batchCount].index = index++;
+                if (++batchCount == WeakArrayBatchCount) {
+                    weak_array_retain_flush(batch, batchCount, result);
+                    batchCount = 0;
+                }
+            }
+        }
+        if (batchCount) weak_array_retain_flush(batch, batchCount, result);
+
+        // Squeeze out objects that deallocated, keeping slot order.
+        for (size_t i = 0; i < index; i++) {
+            if (result[i]) result[count++] = result[i];
+        }
+        if (count == 0) {
+            free(result);
+            result = nil;
+        }
+    }
+
+    if (outObjects) *outObjects = result;
+    else if (result) {
+        objc_releaseArray(result, count);
+        free(result);
+    }
+    return count;
+}
+
+
+size_t
+objc_weakarray_compact(objc_weakarray_t array, size_t maxSlots)
+{
+    size_t removed = 0;
+
+    for (size_t scanned = 0; scanned < maxSlots  &&  array->last; scanned++) {
+        weak_array_chunk_t *last = array->last;
+        id *tail = &last->slots[last->count - 1];
+        if (!*tail) {
+            weak_array_pop(array);
+            removed++;
+            continue;
+        }
+
+        if (!array->cursorChunk) {
+            array->cursorChunk = array->first;
+            array->cursor = 0;
+        }
+        weak_array_chunk_t *chunk = array->cursorChunk;
+        if (array->cursor >= chunk->count) {
+            // Stop at the end of each full pass.
+            array->cursorChunk = chunk->next;
+            array->cursor = 0;
+            if (!array->cursorChunk) break;
+            continue;
+        }
+
+        id *hole = &chunk->slots[array->cursor++];
+        if (*hole  ||  hole == tail) continue;
+
+        // Fill the hole with the last slot. Order is not preserved.
+        weak_array_move(hole, tail);
+        weak_array_pop(array);
+        removed++;
+    }
+
+    return removed;
+}
+
+
 /***********************************************************************
    Autorelease pool implementation
 
@@ -635,6 +1179,8 @@ class AutoreleasePoolPage
 
 #   define POOL_BOUNDARY nil
     static pthread_key_t const key = AUTORELEASE_POOL_KEY;
+    static pthread_key_t const cacheKey = AUTORELEASE_POOL_CACHE_KEY;
+    static pthread_key_t const statsKey = AUTORELEASE_POOL_STATS_KEY;
     static uint8_t const SCRIBBLE = 0xA3;  // 0xA3A3A3A3 after releasing
     static size_t const SIZE = 
 #if PROTECT_AUTORELEASEPOOL
@@ -643,6 +1189,12 @@ class AutoreleasePoolPage
         PAGE_MAX_SIZE;  // size and alignment, power of 2
 #endif
     static size_t const COUNT = SIZE / sizeof(id);
+    // Objects released together by releaseUntil().
+    static size_t const RELEASE_CHUNK = 128;
+    // Seconds between OBJC_PRINT_POOL_STATISTICS lines for a thread.
+    static uint64_t const STATS_PRINT_INTERVAL = 10;
+    // Freed pages kept per thread for reuse by the next new page.
+    static size_t const CACHE_LIMIT = 4;
 
     magic_t const magic;
     id *next;
@@ -654,13 +1206,108 @@ class AutoreleasePoolPage
 
     // SIZE-sizeof(*this) bytes of contents follow
 
+#if SUPPORT_AUTORELEASEPOOL_COALESCING
+    // A pool entry is an object pointer with the number of extra 
+    // times it was autoreleased in the high bits, so autoreleasing 
+    // the object on top of the hot page again just bumps its count.
+    // POOL_BOUNDARY entries are never coalesced.
+    struct entry_t {
+        uintptr_t ptr : 48;
+        uintptr_t count : 16;
+
+        static const uintptr_t maxCount = (1 << 16) - 1;
+    };
+#endif
+
+    static inline id objectForEntry(id *entry) {
+#if SUPPORT_AUTORELEASEPOOL_COALESCING
+        return (id)((entry_t *)entry)->ptr;
+#else
+        return *entry;
+#endif
+    }
+
+    // Number of releases owed to the entry's object at pop.
+    static inline size_t releasesForEntry(id *entry) {
+#if SUPPORT_AUTORELEASEPOOL_COALESCING
+        return 1 + ((entry_t *)entry)->count;
+#else
+        return 1;
+#endif
+    }
+
+    // A freed page in the thread's page cache. 
+    // The cache is a list of these in TLS; the head knows the length 
+    // and the shortest the list has been since the last trim.
+    struct cached_page_t {
+        cached_page_t *next;
+        size_t count;
+        size_t lowWater;
+    };
+
     static void * operator new(size_t size) {
+        cached_page_t *cache = (cached_page_t *)tls_get_direct(cacheKey);
+        if (cache) {
+            cached_page_t *next = cache->next;
+            if (next) {
+                next->count = cache->count - 1;
+                next->lowWater = MIN(cache->lowWater, next->count);
+            }
+            tls_set_direct(cacheKey, (void *)next);
+            return cache;
+        }
         return malloc_zone_memalign(malloc_default_zone(), SIZE, SIZE);
     }
     static void operator delete(void * p) {
+        cached_page_t *cache = (cached_page_t *)tls_get_direct(cacheKey);
+        size_t count = cache ? cache->count : 0;
+        // Page-per-pool debugging wants freed pages to stay freed.
+        if (count < CACHE_LIMIT  &&  !DebugPoolAllocation) {
+            cached_page_t *page = (cached_page_t *)p;
+            page->next = cache;
+            page->count = count + 1;
+            page->lowWater = cache ? cache->lowWater : 0;
+            tls_set_direct(cacheKey, (void *)page);
+            return;
+        }
         return free(p);
     }
 
+    static void freeCachedPages() 
+    {
+        cached_page_t *cache = (cached_page_t *)tls_get_direct(cacheKey);
+        tls_set_direct(cacheKey, nil);
+        while (cache) {
+            cached_page_t *next = cache->next;
+            free(cache);
+            cache = next;
+        }
+    }
+
+    // Called when the thread pops its outermost pool, which is as 
+    // close to idle as the runtime can see. Frees the cached pages 
+    // that went unused since the last trim: a thread that stops 
+    // overflowing its pool pages gives its cache back within two 
+    // rounds of work, while a busy thread keeps what it reuses.
+    static void trimCachedPages()
+    {
+        cached_page_t *cache = (cached_page_t *)tls_get_direct(cacheKey);
+        if (!cache) return;
+
+        size_t unused = cache->lowWater;
+        size_t count = cache->count - unused;
+        while (unused--) {
+            cached_page_t *next = cache->next;
+            free(cache);
+            cache = next;
+        }
+        if (cache) {
+            cache->count = count;
+            cache->lowWater = count;
+        }
+        tls_set_direct(cacheKey, (void *)cache);
+    }
+
     inline void protect() {
 #if PROTECT_AUTORELEASEPOOL
         mprotect(this, SIZE, PROT_READ);
@@ -761,12 +1408,38 @@ class AutoreleasePoolPage
     {
         assert(!full());
         unprotect();
-        id *ret = next;  // faster than `return next-1` because of aliasing
-        *next++ = obj;
+        id *ret = addUnprotected(obj);
         protect();
         return ret;
     }
 
+    // add() for a page the caller has already unprotected.
+    id *addUnprotected(id obj)
+    {
+        assert(!full());
+        id *ret;
+#if SUPPORT_AUTORELEASEPOOL_COALESCING
+        if (obj != POOL_BOUNDARY  &&  !empty()  &&  
+            !DisableAutoreleaseCoalescing) 
+        {
+            entry_t *top = (entry_t *)(next - 1);
+            if (top->ptr == (uintptr_t)obj  &&  top->count < entry_t::maxCount) {
+                top->count++;
+                ret = (id *)top;
+                goto done;
+            }
+        }
+#endif
+        ret = next;  // faster than `return next-1` because of aliasing
+        *next++ = obj;
+        // obj must fit in the entry's pointer bits
+        assert(objectForEntry(ret) == obj);
+#if SUPPORT_AUTORELEASEPOOL_COALESCING
+     done:
+#endif
+        return ret;
+    }
+
     void releaseAll() 
     {
         releaseUntil(begin());
@@ -777,6 +1450,8 @@ class AutoreleasePoolPage
         // Not recursive: we don't want to blow out the stack 
         // if a thread accumulates a stupendous amount of garbage
         
+        id chunk[RELEASE_CHUNK];
+
         while (this->next != stop) {
             // Restart from hotPage() every time, in case -release 
             // autoreleased more objects
@@ -788,14 +1463,43 @@ class AutoreleasePoolPage
                 setHotPage(page);
             }
 
+            // Take up to RELEASE_CHUNK releases off the top of the page 
+            // and release them with objc_releaseArray(), which locks 
+            // each side table stripe once per chunk. Objects are 
+            // deallocated in pool order, top down, as before. 
+            // A deallocation may follow releases of older objects 
+            // in the same chunk, but those releases don't deallocate.
+            size_t count = 0;
+            id *top = page->next;
+            id *entry = top;
+            id hog = nil;
+            size_t hogReleases = 0;
+            while (entry != stop  &&  entry != page->begin()) {
+                id obj = objectForEntry(entry - 1);
+                size_t releases = releasesForEntry(entry - 1);
+                if (obj != POOL_BOUNDARY  &&  
+                    releases > RELEASE_CHUNK - count) 
+                {
+                    if (count > 0) break;
+                    // One object autoreleased many times has 
+                    // nothing to batch with.
+                    hog = obj;
+                    hogReleases = releases;
+                    entry--;
+                    break;
+                }
+                entry--;
+                if (obj == POOL_BOUNDARY) continue;
+                while (releases--) chunk[count++] = obj;
+            }
+
             page->unprotect();
-            id obj = *--page->next;
-            memset((void*)page->next, SCRIBBLE, sizeof(*page->next));
+            page->next = entry;
+            memset((void*)entry, SCRIBBLE, (top - entry) * sizeof(*entry));
             page->protect();
 
-            if (obj != POOL_BOUNDARY) {
-                objc_release(obj);
-            }
+            objc_releaseArray(chunk, count);
+            while (hogReleases--) objc_release(hog);
         }
 
         setHotPage(this);
@@ -849,6 +1553,16 @@ class AutoreleasePoolPage
         
         // clear TLS value so TLS destruction doesn't loop
         setHotPage(nil);
+
+        // cache_dealloc() may have run already
+        freeCachedPages();
+    }
+
+    static void cache_dealloc(void *p) 
+    {
+        // reinstate TLS value while we work
+        tls_set_direct(cacheKey, p);
+        freeCachedPages();
     }
 
     static AutoreleasePoolPage *pageForPointer(const void *p) 
@@ -911,6 +1625,75 @@ class AutoreleasePoolPage
     }
 
 
+    // Per-thread counters for OBJC_RECORD_POOL_STATISTICS.
+    // Sizes are in pool slots, as with OBJC_PRINT_POOL_HIGHWATER.
+    struct pool_stats_t {
+        uint64_t pushes;
+        uint64_t pops;
+        uint64_t hiwat;
+        uint64_t largestPool;
+        uint64_t lastPrint;  // nanoseconds()
+    };
+
+    static pool_stats_t *threadStats(bool create)
+    {
+        pool_stats_t *stats = (pool_stats_t *)tls_get_direct(statsKey);
+        if (!stats  &&  create) {
+            stats = (pool_stats_t *)calloc(1, sizeof(*stats));
+            stats->lastPrint = nanoseconds();
+            tls_set_direct(statsKey, stats);
+        }
+        return stats;
+    }
+
+    static void stats_dealloc(void *p) 
+    {
+        free(p);
+    }
+
+    // Pool slots in use below p on page or its ancestors.
+    static uint64_t mark(AutoreleasePoolPage *page, id *p)
+    {
+        return (uint64_t)page->depth * (page->end() - page->begin()) + 
+            (p - page->begin());
+    }
+
+    static NEVER_INLINE void recordPush()
+    {
+        threadStats(true)->pushes++;
+    }
+
+    static NEVER_INLINE void recordPop(AutoreleasePoolPage *page, id *stop)
+    {
+        pool_stats_t *stats = threadStats(true);
+        stats->pops++;
+
+        if (page) {
+            AutoreleasePoolPage *hot = hotPage();
+            uint64_t top = mark(hot, hot->next);
+            uint64_t size = top - mark(page, stop);
+            if (top > stats->hiwat) stats->hiwat = top;
+            if (size > stats->largestPool) stats->largestPool = size;
+        }
+
+        if (PrintPoolStatistics  &&  
+            nanoseconds() - stats->lastPrint >= STATS_PRINT_INTERVAL*NSEC_PER_SEC)
+        {
+            stats->lastPrint = nanoseconds();
+            objc_autorelease_pool_statistics_t info;
+            getStatistics(&info);
+            _objc_inform("POOL STATISTICS: thread=%p depth=%u pages=%u "
+                         "entries=%llu hiwat=%llu largest=%llu "
+                         "pushes=%llu pops=%llu", 
+                         pthread_self(), info.depth, info.pages, 
+                         (unsigned long long)info.entries, 
+                         (unsigned long long)info.hiwat, 
+                         (unsigned long long)info.largestPool, 
+                         (unsigned long long)info.pushes, 
+                         (unsigned long long)info.pops);
+        }
+    }
+
     static inline id *autoreleaseFast(id obj)
     {
         AutoreleasePoolPage *page = hotPage();
@@ -1004,13 +1787,38 @@ public:
         assert(obj);
         assert(!obj->isTaggedPointer());
         id *dest __unused = autoreleaseFast(obj);
-        assert(!dest  ||  dest == EMPTY_POOL_PLACEHOLDER  ||  *dest == obj);
+        assert(!dest  ||  dest == EMPTY_POOL_PLACEHOLDER  ||  
+               objectForEntry(dest) == obj);
         return obj;
     }
 
+    // Autoreleases count objects, unprotecting each page once 
+    // for all of the objects that fit on it.
+    // The objects must not be nil or tagged pointers.
+    static void autoreleaseArray(id *objects, size_t count)
+    {
+        size_t i = 0;
+        while (i < count) {
+            AutoreleasePoolPage *page = hotPage();
+            if (!page  ||  page->full()) {
+                // Let the usual path add a page or report a missing pool.
+                autorelease(objects[i++]);
+                continue;
+            }
+            page->unprotect();
+            while (i < count  &&  !page->full()) {
+                assert(objects[i]  &&  !objects[i]->isTaggedPointer());
+                page->addUnprotected(objects[i++]);
+            }
+            page->protect();
+        }
+    }
+
 
     static inline void *push() 
     {
+        if (slowpath(RecordPoolStatistics)) recordPush();
+
         id *dest;
         if (DebugPoolAllocation) {
             // Each autorelease pool starts on a new pool page.
@@ -1060,6 +1868,7 @@ public:
                 pop(coldPage()->begin());
             } else {
                 // Pool was never used. Clear the placeholder.
+                if (slowpath(RecordPoolStatistics)) recordPop(nil, nil);
                 setHotPage(nil);
             }
             return;
@@ -1080,9 +1889,13 @@ public:
         }
 
         if (PrintPoolHiwat) printHiwat();
+        if (slowpath(RecordPoolStatistics)) recordPop(page, stop);
 
         page->releaseUntil(stop);
 
+        // The outermost pool is empty. See trimCachedPages().
+        bool idle = page->empty()  &&  !page->parent;
+
         // memory: delete empty children
         if (DebugPoolAllocation  &&  page->empty()) {
             // special case: delete everything during page-per-pool debugging
@@ -1104,6 +1917,13 @@ public:
                 page->child->child->kill();
             }
         }
+
+        if (idle) {
+            trimCachedPages();
+#if SUPPORT_BIASED_REFCOUNTS
+            if (BiasedRefcounts) biasedMergeDebts();
+#endif
+        }
     }
 
     static void init()
@@ -1111,6 +1931,12 @@ public:
         int r __unused = pthread_key_init_np(AutoreleasePoolPage::key, 
                                              AutoreleasePoolPage::tls_dealloc);
         assert(r == 0);
+        r = pthread_key_init_np(AutoreleasePoolPage::cacheKey, 
+                                AutoreleasePoolPage::cache_dealloc);
+        assert(r == 0);
+        r = pthread_key_init_np(AutoreleasePoolPage::statsKey, 
+                                AutoreleasePoolPage::stats_dealloc);
+        assert(r == 0);
     }
 
     void print() 
@@ -1121,11 +1947,17 @@ public:
                      this == coldPage() ? "(cold)" : "");
         check(false);
         for (id *p = begin(); p < next; p++) {
-            if (*p == POOL_BOUNDARY) {
+            id obj = objectForEntry(p);
+            size_t releases = releasesForEntry(p);
+            if (obj == POOL_BOUNDARY) {
                 _objc_inform("[%p]  ################  POOL %p", p, p);
+            } else if (releases > 1) {
+                _objc_inform("[%p]  %#16lx  %s  autorelease count %zu", 
+                             p, (unsigned long)obj, 
+                             object_getClassName(obj), releases);
             } else {
                 _objc_inform("[%p]  %#16lx  %s", 
-                             p, (unsigned long)*p, object_getClassName(*p));
+                             p, (unsigned long)obj, object_getClassName(obj));
             }
         }
     }
@@ -1138,7 +1970,9 @@ public:
         AutoreleasePoolPage *page;
         ptrdiff_t objects = 0;
         for (page = coldPage(); page; page = page->child) {
-            objects += page->next - page->begin();
+            for (id *p = page->begin(); p < page->next; p++) {
+                objects += releasesForEntry(p);
+            }
         }
         _objc_inform("%llu releases pending.", (unsigned long long)objects);
 
@@ -1157,6 +1991,29 @@ public:
         _objc_inform("##############");
     }
 
+    static void getStatistics(objc_autorelease_pool_statistics_t *info)
+    {
+        bzero(info, sizeof(*info));
+
+        if (haveEmptyPoolPlaceholder()) {
+            info->depth = 1;
+        }
+        for (AutoreleasePoolPage *page = coldPage(); page; page = page->child) {
+            info->pages++;
+            for (id *p = page->begin(); p < page->next; p++) {
+                if (objectForEntry(p) == POOL_BOUNDARY) info->depth++;
+                else info->entries += releasesForEntry(p);
+            }
+        }
+
+        if (pool_stats_t *stats = threadStats(false)) {
+            info->pushes = stats->pushes;
+            info->pops = stats->pops;
+            info->hiwat = stats->hiwat;
+            info->largestPool = stats->largestPool;
+        }
+    }
+
     static void printHiwat()
     {
         // Check and propagate high water mark
@@ -1191,6 +2048,95 @@ public:
 };
 
 
+#if SUPPORT_NONPOINTER_ISA
+
+/***********************************************************************
+* Side table overflow slots
+* A nonpointer isa object whose inline retain count overflowed keeps 
+* the excess in one of its side table's overflow slots if one is free, 
+* and in refcnts otherwise. Slots are claimed and freed with the side 
+* table locked, but their counts change atomically. That lets a retain 
+* that overflows again, and a release that must borrow from the side 
+* table, usually do it without the lock (see sidetable_tryAddExtraRC() 
+* and sidetable_tryBorrowExtraRC()).
+* A lock-free adder or borrower counts itself in flight while the counts 
+* it moves are in neither the slot nor the isa. Anything that 
+* needs to trust a zero count, or to free the slot, waits for them. 
+* Releases drop the lock to wait. Slots are freed only after the isa 
+* stopped being a nonpointer isa or started deallocating, so anything 
+* in flight then has already finished with the isa.
+**********************************************************************/
+
+// Slots hold objects disguised like DisguisedPtr does.
+static inline uintptr_t
+overflow_key(objc_object *obj)
+{
+    return -(uintptr_t)obj;
+}
+
+
+static overflow_slot_t *
+overflow_find(SideTable& table, objc_object *obj)
+{
+    overflow_slot_t *slots = table.overflow;
+    if (!slots) return nil;
+    uintptr_t key = overflow_key(obj);
+    for (unsigned i = 0; i < OverflowSlotCount; i++) {
+        if (slots[i].key == key) return &slots[i];
+    }
+    return nil;
+}
+
+
+// Claims a free slot for obj. Returns nil if there isn't one.
+static overflow_slot_t *
+overflow_claim_nolock(SideTable& table, objc_object *obj)
+{
+    overflow_slot_t *slots = table.overflow;
+    if (!slots) {
+        slots = (overflow_slot_t *)
+            calloc(OverflowSlotCount, sizeof(overflow_slot_t));
+        OSMemoryBarrier();
+        table.overflow = slots;
+    }
+    for (unsigned i = 0; i < OverflowSlotCount; i++) {
+        // A straggling borrower may still be backing out of a 
+        // freed slot. Leave it until its word is zero again.
+        if (slots[i].key == 0  &&  slots[i].word == 0) {
+            slots[i].key = overflow_key(obj);
+            return &slots[i];
+        }
+    }
+    return nil;
+}
+
+
+// Empties slot once no borrow is in flight, and returns its count.
+static uint64_t
+overflow_drain_nolock(overflow_slot_t *slot)
+{
+    uint64_t word;
+    do {
+        while ((word = slot->word) & OVERFLOW_INFLIGHT_MASK) {
+            sched_yield();
+        }
+    } while (!__sync_bool_compare_and_swap(&slot->word, word, 0));
+    return word >> OVERFLOW_COUNT_SHIFT;
+}
+
+
+// Frees slot, and returns its count.
+static uint64_t
+overflow_free_nolock(overflow_slot_t *slot)
+{
+    uint64_t count = overflow_drain_nolock(slot);
+    slot->key = 0;
+    return count;
+}
+
+#endif
+
+
 /***********************************************************************
 * Slow paths for inline control
 **********************************************************************/
@@ -1200,6 +2146,7 @@ public:
 NEVER_INLINE id 
 objc_object::rootRetain_overflow(bool tryRetain)
 {
+    if (sidetable_tryAddExtraRC()) return (id)this;
     return rootRetain(tryRetain, true);
 }
 
@@ -1207,6 +2154,7 @@ objc_object::rootRetain_overflow(bool tryRetain)
 NEVER_INLINE bool 
 objc_object::rootRelease_underflow(bool performDealloc)
 {
+    if (sidetable_tryBorrowExtraRC()) return false;
     return rootRelease(performDealloc, true);
 }
 
@@ -1224,13 +2172,190 @@ objc_object::clearDeallocating_slow()
     table.lock();
     if (isa.weakly_referenced) {
         weak_clear_no_lock(&table.weak_table, (id)this);
+        table.waitForWeakLoads();
     }
     if (isa.has_sidetable_rc) {
         table.refcnts.erase(this);
+        if (overflow_slot_t *slot = overflow_find(table, this)) {
+            overflow_free_nolock(slot);
+        }
     }
     table.unlock();
 }
 
+
+#if SUPPORT_BIASED_REFCOUNTS
+
+/***********************************************************************
+* Biased retain counts (OBJC_BIASED_REFCOUNTS)
+* See objc-object.h. 
+* For an object biased to thread T with T's entry count n and 
+* side table debt d, the true retain count is (inline count - 1) + n - d.
+**********************************************************************/
+
+static biased_rc_table_t *biased_table(bool create)
+{
+    biased_rc_table_t *table = (biased_rc_table_t *)
+        tls_get_direct(BIASED_RC_KEY);
+    if (!table  &&  create) {
+        table = (biased_rc_table_t *)calloc(1, sizeof(*table));
+        tls_set_direct(BIASED_RC_KEY, table);
+    }
+    return table;
+}
+
+
+// Ends obj's bias towards table, whose entry for obj is entry.
+// The entry's count and any debt are folded into the inline count.
+// Returns true if obj should now be deallocated (if !performDealloc).
+static bool biased_unbias(biased_rc_table_t *table, biased_rc_entry_t *entry, 
+                          bool performDealloc)
+{
+    objc_object *obj = entry->obj;
+    intptr_t count = (intptr_t)entry->count;
+    entry->obj = nil;
+    entry->count = 0;
+
+    SideTable& sideTable = SideTables()[obj];
+    sideTable.lock();
+    BiasedMap::iterator it = sideTable.biased.find(obj);
+    assert(it != sideTable.biased.end()  &&  it->second.owner == table);
+    count -= (intptr_t)it->second.debt;
+    sideTable.biased.erase(it);
+    sideTable.unlock();
+
+    // The table's own retain goes too.
+    count -= 1;
+
+    for ( ; count > 0; count--) obj->rootRetain();
+    for ( ; count < -1; count++) obj->rootRelease();
+    if (count == 0) return false;
+    return performDealloc ? obj->rootRelease() 
+                          : obj->rootReleaseShouldDealloc();
+}
+
+
+// Applies the debts other threads recorded against this thread's entries.
+// Called from rootRelease(), so an entry may be unbiased by a nested 
+// merge while this one runs; each entry is re-read before it is used.
+void biased_merge(biased_rc_table_t *table)
+{
+    table->hasDebts = false;
+
+    for (unsigned i = 0; i < biased_rc_table_t::EntryCount; i++) {
+        biased_rc_entry_t *entry = &table->entries[i];
+        objc_object *obj = entry->obj;
+        if (!obj) continue;
+
+        SideTable& sideTable = SideTables()[obj];
+        sideTable.lock();
+        BiasedMap::iterator it = sideTable.biased.find(obj);
+        assert(it != sideTable.biased.end()  &&  it->second.owner == table);
+        size_t debt = it->second.debt;
+        if (debt < entry->count) {
+            entry->count -= debt;
+            it->second.debt = 0;
+            debt = 0;
+        }
+        sideTable.unlock();
+
+        // Every retain this thread counted has been released elsewhere.
+        if (debt) biased_unbias(table, entry, true);
+    }
+}
+
+
+static void biased_table_dealloc(void *p)
+{
+    biased_rc_table_t *table = (biased_rc_table_t *)p;
+    tls_set_direct(BIASED_RC_KEY, nil);
+
+    for (unsigned i = 0; i < biased_rc_table_t::EntryCount; i++) {
+        biased_rc_entry_t *entry = &table->entries[i];
+        if (entry->obj) biased_unbias(table, entry, true);
+    }
+    free(table);
+}
+
+
+// Biases a newly allocated object to this thread if its entry is free.
+NEVER_INLINE void
+objc_object::biasedAdopt()
+{
+    assert(isa.nonpointer  &&  isa.extra_rc == 0);
+
+    biased_rc_table_t *table = biased_table(true);
+    if (table->hasDebts) biased_merge(table);
+
+    biased_rc_entry_t& entry = table->entryFor(this);
+    if (entry.obj) return;
+
+    SideTable& sideTable = SideTables()[this];
+    sideTable.lock();
+    biased_rc_t& bias = sideTable.biased[this];
+    bias.owner = table;
+    bias.debt = 0;
+    sideTable.unlock();
+
+    // The allocation's retain moves to the table. The inline count 
+    // keeps it on the table's behalf. has_sidetable_rc sends the 
+    // release of that last inline retain to the side table, 
+    // where sidetable_deferBiasedRelease_nolock() can see the bias.
+    // Nobody else can see this object yet.
+    isa.has_sidetable_rc = true;
+    entry.obj = this;
+    entry.count = 1;
+}
+
+
+// The owning thread's release of its last biased retain.
+NEVER_INLINE bool
+objc_object::biasedRelease_last(biased_rc_entry_t *entry, bool performDealloc)
+{
+    assert(entry->count == 1);
+    entry->count = 0;
+    biased_rc_table_t *table = biased_table(false);
+    bool result = biased_unbias(table, entry, performDealloc);
+    if (table->hasDebts) biased_merge(table);
+    return result;
+}
+
+
+// Called with the side table locked when a release would deallocate.
+// If the object is biased to some thread, the release is recorded 
+// against that thread's count instead, and this returns true.
+bool 
+objc_object::sidetable_deferBiasedRelease_nolock()
+{
+    SideTable& table = SideTables()[this];
+    BiasedMap::iterator it = table.biased.find(this);
+    if (it == table.biased.end()) return false;
+
+    it->second.debt++;
+    it->second.owner->hasDebts = true;
+    return true;
+}
+
+
+// Called with the side table locked.
+// Returns the part of the retain count held by a biased count, 
+// which is only visible to the owning thread.
+intptr_t 
+objc_object::sidetable_getBiasedRC_nolock()
+{
+    SideTable& table = SideTables()[this];
+    BiasedMap::iterator it = table.biased.find(this);
+    if (it == table.biased.end()) return 0;
+
+    intptr_t result = -1 - (intptr_t)it->second.debt;
+    biased_rc_entry_t *entry = biasedEntry(this);
+    if (entry) result += (intptr_t)entry->count;
+    return result;
+}
+
+// SUPPORT_BIASED_REFCOUNTS
+#endif
+
 #endif
 
 __attribute__((noinline,used))
@@ -1275,6 +2400,10 @@ objc_object::sidetable_present()
     RefcountMap::iterator it = table.refcnts.find(this);
     if (it != table.refcnts.end()) result = true;
 
+#if SUPPORT_NONPOINTER_ISA
+    if (overflow_find(table, this)) result = true;
+#endif
+
     if (weak_is_registered_no_lock(&table.weak_table, (id)this)) result = true;
 
     table.unlock();
@@ -1300,12 +2429,118 @@ objc_object::sidetable_unlock()
 }
 
 
+// Moves RC_HALF retain counts from the inline count to the side table 
+// without locking the side table, and performs the retain that found 
+// the inline count full. Only works if the object already has a slot.
+// Returns false if the side table lock is needed.
+bool
+objc_object::sidetable_tryAddExtraRC()
+{
+    SideTable& table = SideTables()[this];
+    overflow_slot_t *slot = overflow_find(table, this);
+    if (!slot) return false;
+
+    const uint64_t half = (uint64_t)RC_HALF << OVERFLOW_COUNT_SHIFT;
+
+    // Mark the counts in flight. Leave room for every other 
+    // operation in flight to add too, so the count can't wrap.
+    uint64_t word;
+    do {
+        word = slot->word;
+        if ((word & OVERFLOW_PINNED)  ||  
+            (word >> OVERFLOW_COUNT_SHIFT) >= 
+            (OVERFLOW_PINNED >> OVERFLOW_COUNT_SHIFT) / 2  ||  
+            (word & OVERFLOW_INFLIGHT_MASK) == OVERFLOW_INFLIGHT_MASK)
+        {
+            return false;
+        }
+    } while (!__sync_bool_compare_and_swap(&slot->word, word, word+1));
+
+    // The slot may have been freed and reused before we marked it.
+    bool stored = false;
+    if (slot->key == overflow_key(this)) {
+        // Take them from the inline count, redoing the retain too.
+        isa_t oldisa;
+        isa_t newisa;
+        do {
+            oldisa = LoadExclusive(&isa.bits);
+            newisa = oldisa;
+            if (!newisa.nonpointer  ||  newisa.deallocating  ||  
+                !newisa.has_sidetable_rc  ||  
+                newisa.extra_rc != RC_IMMORTAL - 1)
+            {
+                break;
+            }
+            newisa.extra_rc = RC_HALF - 1;
+            stored = StoreExclusive(&isa.bits, oldisa.bits, newisa.bits);
+        } while (!stored);
+        if (!stored) ClearExclusive(&isa.bits);
+    }
+
+    if (stored) __sync_fetch_and_add(&slot->word, half - 1);
+    else __sync_fetch_and_sub(&slot->word, 1);
+    return stored;
+}
+
+
+// Moves RC_HALF retain counts from the side table to the inline 
+// count without locking the side table, and performs the release 
+// that found the inline count empty.
+// Returns false if the side table lock is needed.
+bool
+objc_object::sidetable_tryBorrowExtraRC()
+{
+    SideTable& table = SideTables()[this];
+    overflow_slot_t *slot = overflow_find(table, this);
+    if (!slot) return false;
+
+    const uint64_t half = (uint64_t)RC_HALF << OVERFLOW_COUNT_SHIFT;
+
+    // Take the counts and mark them in flight.
+    uint64_t word;
+    do {
+        word = slot->word;
+        if ((word & OVERFLOW_PINNED)  ||  
+            (word >> OVERFLOW_COUNT_SHIFT) < RC_HALF  ||  
+            (word & OVERFLOW_INFLIGHT_MASK) == OVERFLOW_INFLIGHT_MASK)
+        {
+            return false;
+        }
+    } while (!__sync_bool_compare_and_swap(&slot->word, word, word-half+1));
+
+    // The slot may have been freed and reused before we took them.
+    bool stored = false;
+    if (slot->key == overflow_key(this)) {
+        // Add them to the inline count, redoing the release too.
+        isa_t oldisa;
+        isa_t newisa;
+        do {
+            oldisa = LoadExclusive(&isa.bits);
+            newisa = oldisa;
+            uintptr_t overflow;
+            if (!newisa.nonpointer  ||  newisa.deallocating) break;
+            newisa.bits = 
+                addc(newisa.bits, RC_ONE * (RC_HALF-1), 0, &overflow);
+            if (overflow  ||  newisa.isImmortal()) break;
+            stored = StoreReleaseExclusive(&isa.bits, 
+                                           oldisa.bits, newisa.bits);
+        } while (!stored);
+        if (!stored) ClearExclusive(&isa.bits);
+    }
+
+    if (stored) __sync_fetch_and_sub(&slot->word, 1);
+    else __sync_fetch_and_add(&slot->word, half - 1);
+    return stored;
+}
+
+
 // Move the entire retain count to the side table, 
-// as well as isDeallocating and weaklyReferenced.
+// as well as isDeallocating, weaklyReferenced and immortal.
 void 
 objc_object::sidetable_moveExtraRC_nolock(size_t extra_rc, 
                                           bool isDeallocating, 
-                                          bool weaklyReferenced)
+                                          bool weaklyReferenced, 
+                                          bool immortal)
 {
     assert(!isa.nonpointer);        // should already be changed to raw pointer
     SideTable& table = SideTables()[this];
@@ -1316,11 +2551,22 @@ objc_object::sidetable_moveExtraRC_nolock(size_t extra_rc,
     assert((oldRefcnt & SIDE_TABLE_DEALLOCATING) == 0);  
     assert((oldRefcnt & SIDE_TABLE_WEAKLY_REFERENCED) == 0);  
 
+    // Raw isa objects keep everything in refcnts.
+    if (overflow_slot_t *slot = overflow_find(table, this)) {
+        uint64_t count = overflow_free_nolock(slot);
+        if (count & (OVERFLOW_PINNED >> OVERFLOW_COUNT_SHIFT)) {
+            immortal = true;
+        } else {
+            extra_rc += (size_t)count;
+        }
+    }
+
     uintptr_t carry;
     size_t refcnt = addc(oldRefcnt, extra_rc << SIDE_TABLE_RC_SHIFT, 0, &carry);
     if (carry) refcnt = SIDE_TABLE_RC_PINNED;
     if (isDeallocating) refcnt |= SIDE_TABLE_DEALLOCATING;
     if (weaklyReferenced) refcnt |= SIDE_TABLE_WEAKLY_REFERENCED;
+    if (immortal) refcnt |= SIDE_TABLE_RC_PINNED;
 
     refcntStorage = refcnt;
 }
@@ -1332,8 +2578,31 @@ bool
 objc_object::sidetable_addExtraRC_nolock(size_t delta_rc)
 {
     assert(isa.nonpointer);
+    // Side table counts move in units of RC_HALF. See rootRetain().
+    assert(delta_rc % RC_HALF == 0);
     SideTable& table = SideTables()[this];
 
+    overflow_slot_t *slot = overflow_find(table, this);
+    if (!slot  &&  table.refcnts.find(this) == table.refcnts.end()) {
+        slot = overflow_claim_nolock(table, this);
+    }
+    if (slot) {
+        uint64_t word;
+        uint64_t newWord;
+        do {
+            word = slot->word;
+            if (word & OVERFLOW_PINNED) return true;
+            assert((word >> OVERFLOW_COUNT_SHIFT) % RC_HALF == 0);
+            uint64_t count = (word >> OVERFLOW_COUNT_SHIFT) + delta_rc;
+            if (count >= (OVERFLOW_PINNED >> OVERFLOW_COUNT_SHIFT)) {
+                newWord = OVERFLOW_PINNED | (word & OVERFLOW_INFLIGHT_MASK);
+            } else {
+                newWord = word + ((uint64_t)delta_rc << OVERFLOW_COUNT_SHIFT);
+            }
+        } while (!__sync_bool_compare_and_swap(&slot->word, word, newWord));
+        return (newWord & OVERFLOW_PINNED) != 0;
+    }
+
     size_t& refcntStorage = table.refcnts[this];
     size_t oldRefcnt = refcntStorage;
     // isa-side bits should not be set here
@@ -1341,6 +2610,7 @@ objc_object::sidetable_addExtraRC_nolock(size_t delta_rc)
     assert((oldRefcnt & SIDE_TABLE_WEAKLY_REFERENCED) == 0);
 
     if (oldRefcnt & SIDE_TABLE_RC_PINNED) return true;
+    assert((oldRefcnt >> SIDE_TABLE_RC_SHIFT) % RC_HALF == 0);
 
     uintptr_t carry;
     size_t newRefcnt = 
@@ -1358,13 +2628,40 @@ objc_object::sidetable_addExtraRC_nolock(size_t delta_rc)
 
 
 // Move some retain counts from the side table to the isa field.
-// Returns the actual count subtracted, which may be less than the request.
+// Returns the count subtracted: either all of it or none. Returns 
+// SIDE_TABLE_RC_BUSY instead of none while lock-free borrows may 
+// still put counts back.
 size_t 
 objc_object::sidetable_subExtraRC_nolock(size_t delta_rc)
 {
     assert(isa.nonpointer);
+    assert(delta_rc == RC_HALF);
     SideTable& table = SideTables()[this];
 
+    if (overflow_slot_t *slot = overflow_find(table, this)) {
+        while (1) {
+            uint64_t word = slot->word;
+            if (word & OVERFLOW_PINNED) return delta_rc;
+            assert((word >> OVERFLOW_COUNT_SHIFT) % RC_HALF == 0);
+            if ((word >> OVERFLOW_COUNT_SHIFT) >= delta_rc) {
+                uint64_t newWord = 
+                    word - ((uint64_t)delta_rc << OVERFLOW_COUNT_SHIFT);
+                if (__sync_bool_compare_and_swap(&slot->word, word, newWord)) {
+                    return delta_rc;
+                }
+            } 
+            else if (word & OVERFLOW_INFLIGHT_MASK) {
+                // Borrows in flight may yet put counts back, 
+                // and the caller is about to trust a zero count.
+                // Don't wait for them with the lock held.
+                return SIDE_TABLE_RC_BUSY;
+            } 
+            else {
+                return 0;
+            }
+        }
+    }
+
     RefcountMap::iterator it = table.refcnts.find(this);
     if (it == table.refcnts.end()  ||  it->second == 0) {
         // Side table retain count is zero. Can't borrow.
@@ -1375,6 +2672,8 @@ objc_object::sidetable_subExtraRC_nolock(size_t delta_rc)
     // isa-side bits should not be set here
     assert((oldRefcnt & SIDE_TABLE_DEALLOCATING) == 0);
     assert((oldRefcnt & SIDE_TABLE_WEAKLY_REFERENCED) == 0);
+    assert((oldRefcnt & SIDE_TABLE_RC_PINNED)  ||  
+           (oldRefcnt >> SIDE_TABLE_RC_SHIFT) % RC_HALF == 0);
 
     size_t newRefcnt = oldRefcnt - (delta_rc << SIDE_TABLE_RC_SHIFT);
     assert(oldRefcnt > newRefcnt);  // shouldn't underflow
@@ -1388,6 +2687,13 @@ objc_object::sidetable_getExtraRC_nolock()
 {
     assert(isa.nonpointer);
     SideTable& table = SideTables()[this];
+    if (overflow_slot_t *slot = overflow_find(table, this)) {
+        uint64_t word = slot->word;
+        if (word & OVERFLOW_PINNED) {
+            return SIDE_TABLE_RC_PINNED >> SIDE_TABLE_RC_SHIFT;
+        }
+        return (size_t)(word >> OVERFLOW_COUNT_SHIFT);
+    }
     RefcountMap::iterator it = table.refcnts.find(this);
     if (it == table.refcnts.end()) return 0;
     else return it->second >> SIDE_TABLE_RC_SHIFT;
@@ -1404,6 +2710,8 @@ objc_object::sidetable_retain()
 #if SUPPORT_NONPOINTER_ISA
     assert(!isa.nonpointer);
 #endif
+    if (slowpath(sidetable_isImmortal())) return (id)this;
+
     SideTable& table = SideTables()[this];
     
     table.lock();
@@ -1518,6 +2826,67 @@ objc_object::sidetable_setWeaklyReferenced_nolock()
 }
 
 
+// Raw isa objects made immortal, so that their retain and release 
+// can skip the side table lock. Entries are never removed, so 
+// readers need no lock. An object that doesn't fit is still immortal 
+// through its pinned side table count, but takes the lock.
+enum { ImmortalObjectCount = 64 };
+static objc_object * volatile ImmortalObjects[ImmortalObjectCount];
+static bool ImmortalObjectsExist;
+
+static inline unsigned immortal_index(objc_object *obj, unsigned i)
+{
+    return (unsigned)(((uintptr_t)obj >> 4) + i) & (ImmortalObjectCount-1);
+}
+
+static void immortal_add(objc_object *obj)
+{
+    for (unsigned i = 0; i < ImmortalObjectCount; i++) {
+        objc_object * volatile *slot = &ImmortalObjects[immortal_index(obj, i)];
+        if (!*slot  &&  __sync_bool_compare_and_swap(slot, nil, obj)) {
+            ImmortalObjectsExist = true;
+            return;
+        }
+        if (*slot == obj) return;
+    }
+}
+
+
+bool 
+objc_object::sidetable_isImmortal()
+{
+    if (fastpath(!ImmortalObjectsExist)) return false;
+
+    for (unsigned i = 0; i < ImmortalObjectCount; i++) {
+        objc_object *entry = ImmortalObjects[immortal_index(this, i)];
+        if (entry == this) return true;
+        if (!entry) return false;
+    }
+    return false;
+}
+
+
+// A raw isa object is immortal when its side table retain count is 
+// pinned. Retain and release leave a pinned count alone. 
+// The object is also recorded where retain and release can find it 
+// without the side table lock.
+void 
+objc_object::sidetable_setImmortal()
+{
+#if SUPPORT_NONPOINTER_ISA
+    assert(!isa.nonpointer);
+#endif
+
+    SideTable& table = SideTables()[this];
+
+    table.lock();
+    table.refcnts[this] |= SIDE_TABLE_RC_PINNED;
+    table.unlock();
+
+    immortal_add(this);
+}
+
+
 // rdar://20206767
 // return uintptr_t instead of bool so that the various raw-isa 
 // -release paths all return zero in eax
@@ -1527,12 +2896,24 @@ objc_object::sidetable_release(bool performDealloc)
 #if SUPPORT_NONPOINTER_ISA
     assert(!isa.nonpointer);
 #endif
+    if (slowpath(sidetable_isImmortal())) return false;
+
     SideTable& table = SideTables()[this];
 
     bool do_dealloc = false;
 
     table.lock();
     RefcountMap::iterator it = table.refcnts.find(this);
+#if SUPPORT_BIASED_REFCOUNTS
+    // A biased object whose isa has since become a raw pointer.
+    if (slowpath(BiasedRefcounts)  &&  
+        (it == table.refcnts.end()  ||  it->second < SIDE_TABLE_DEALLOCATING)
+        &&  sidetable_deferBiasedRelease_nolock())
+    {
+        table.unlock();
+        return false;
+    }
+#endif
     if (it == table.refcnts.end()) {
         do_dealloc = true;
         table.refcnts[this] = SIDE_TABLE_DEALLOCATING;
@@ -1564,6 +2945,9 @@ objc_object::sidetable_clearDeallocating()
     if (it != table.refcnts.end()) {
         if (it->second & SIDE_TABLE_WEAKLY_REFERENCED) {
             weak_clear_no_lock(&table.weak_table, (id)this);
+#if SUPPORT_NONPOINTER_ISA
+            table.waitForWeakLoads();
+#endif
         }
         table.refcnts.erase(it);
     }
@@ -1608,6 +2992,406 @@ objc_autorelease(id obj)
 }
 
 
+/***********************************************************************
+* objc_retainArray
+* objc_releaseArray
+* objc_autoreleaseArray
+* Retain, release, or autorelease each object in a buffer. 
+* nil and tagged pointer objects are skipped. Objects of classes with 
+* custom retain/release are sent the message.
+* Other objects are updated inline where possible. Objects that need 
+* their side table are sorted by side table, and each table is locked 
+* once for all of them. Deallocation waits until no table is locked, 
+* and objects are deallocated in buffer order.
+**********************************************************************/
+
+// Objects needing their side table, handled in groups of this many.
+enum { BatchSideTableCount = 256 };
+// How far ahead to prefetch isa words.
+enum { BatchPrefetchDistance = 8 };
+
+struct batch_entry_t {
+    SideTable *table;
+    objc_object *obj;
+    size_t index;  // position in the batch before sorting
+
+    bool operator < (const batch_entry_t& other) const {
+        return table < other.table;
+    }
+};
+
+static bool batch_index_less(const batch_entry_t& a, const batch_entry_t& b)
+{
+    return a.index < b.index;
+}
+
+
+#if SUPPORT_NONPOINTER_ISA
+
+ALWAYS_INLINE bool
+objc_object::batchRetain_inline()
+{
+    isa_t oldisa;
+    isa_t newisa;
+
+    do {
+        oldisa = LoadExclusive(&isa.bits);
+        newisa = oldisa;
+        if (!newisa.nonpointer) goto raw;
+        if (newisa.isImmortal()) goto done;
+        newisa.bits += RC_ONE;  // extra_rc++, below RC_IMMORTAL so no carry
+        if (newisa.isImmortal()) goto side;
+    } while (!StoreExclusive(&isa.bits, oldisa.bits, newisa.bits));
+    return true;
+
+ done:
+    ClearExclusive(&isa.bits);
+    return true;
+
+ raw:
+    ClearExclusive(&isa.bits);
+    return sidetable_isImmortal();
+
+ side:
+    ClearExclusive(&isa.bits);
+    return oldisa.has_sidetable_rc  &&  sidetable_tryAddExtraRC();
+}
+
+
+ALWAYS_INLINE bool
+objc_object::batchRelease_inline()
+{
+    isa_t oldisa;
+    isa_t newisa;
+
+    do {
+        oldisa = LoadExclusive(&isa.bits);
+        newisa = oldisa;
+        uintptr_t carry;
+        if (!newisa.nonpointer) goto raw;
+        if (newisa.isImmortal()) goto done;
+        newisa.bits = subc(newisa.bits, RC_ONE, 0, &carry);  // extra_rc--
+        if (carry) goto side;
+    } while (!StoreReleaseExclusive(&isa.bits, oldisa.bits, newisa.bits));
+    return true;
+
+ done:
+    ClearExclusive(&isa.bits);
+    return true;
+
+ raw:
+    ClearExclusive(&isa.bits);
+    return sidetable_isImmortal();
+
+ side:
+    ClearExclusive(&isa.bits);
+    return oldisa.has_sidetable_rc  &&  sidetable_tryBorrowExtraRC();
+}
+
+#else
+
+ALWAYS_INLINE bool objc_object::batchRetain_inline() { 
+    return sidetable_isImmortal(); 
+}
+ALWAYS_INLINE bool objc_object::batchRelease_inline() { 
+    return sidetable_isImmortal(); 
+}
+
+#endif
+
+
+void
+objc_object::batchRetain_nolock()
+{
+    SideTable& table = SideTables()[this];
+
+#if SUPPORT_NONPOINTER_ISA
+    isa_t oldisa;
+    isa_t newisa;
+    bool transcribeToSideTable;
+
+    do {
+        transcribeToSideTable = false;
+        oldisa = LoadExclusive(&isa.bits);
+        newisa = oldisa;
+        if (!newisa.nonpointer) {
+            ClearExclusive(&isa.bits);
+            goto raw;
+        }
+        if (newisa.isImmortal()) {
+            ClearExclusive(&isa.bits);
+            return;
+        }
+        newisa.bits += RC_ONE;  // extra_rc++, below RC_IMMORTAL so no carry
+        if (newisa.isImmortal()) {
+            // Leave half of the retain counts inline and 
+            // copy the other half, exactly RC_HALF, to the side table.
+            transcribeToSideTable = true;
+            newisa.extra_rc = RC_HALF - 1;
+            newisa.has_sidetable_rc = true;
+        }
+    } while (!StoreExclusive(&isa.bits, oldisa.bits, newisa.bits));
+
+    if (transcribeToSideTable) sidetable_addExtraRC_nolock(RC_HALF);
+    return;
+
+ raw:
+#endif
+    size_t& refcntStorage = table.refcnts[this];
+    if (! (refcntStorage & SIDE_TABLE_RC_PINNED)) {
+        refcntStorage += SIDE_TABLE_RC_ONE;
+    }
+}
+
+
+bool
+objc_object::batchRelease_nolock()
+{
+    SideTable& table = SideTables()[this];
+
+#if SUPPORT_NONPOINTER_ISA
+    isa_t oldisa;
+    isa_t newisa;
+
+ retry:
+    oldisa = LoadExclusive(&isa.bits);
+    newisa = oldisa;
+    if (!newisa.nonpointer) {
+        ClearExclusive(&isa.bits);
+        goto raw;
+    }
+    if (newisa.isImmortal()) {
+        ClearExclusive(&isa.bits);
+        return false;
+    }
+    uintptr_t carry;
+    newisa.bits = subc(newisa.bits, RC_ONE, 0, &carry);  // extra_rc--
+    if (!carry) {
+        if (!StoreReleaseExclusive(&isa.bits, oldisa.bits, newisa.bits)) {
+            goto retry;
+        }
+        return false;
+    }
+    ClearExclusive(&isa.bits);
+
+    if (oldisa.has_sidetable_rc) {
+        size_t borrowed = sidetable_subExtraRC_nolock(RC_HALF);
+        if (borrowed == SIDE_TABLE_RC_BUSY) {
+            // Let lock-free borrows finish without the lock. 
+            // The batch holds nothing else of this table's.
+            table.unlock();
+            spin_pause();
+            table.lock();
+            goto retry;
+        }
+        if (borrowed > 0) {
+            // Add them to the inline count, redoing the decrement too.
+            // The side table lock keeps the isa nonpointer.
+            do {
+                oldisa = LoadExclusive(&isa.bits);
+                newisa = oldisa;
+                uintptr_t overflow;
+                newisa.bits = 
+                    addc(newisa.bits, RC_ONE * (borrowed-1), 0, &overflow);
+                if (overflow  ||  newisa.isImmortal()) {
+                    // Retained meanwhile. Put them back and start over.
+                    ClearExclusive(&isa.bits);
+                    sidetable_addExtraRC_nolock(borrowed);
+                    goto retry;
+                }
+            } while (!StoreReleaseExclusive(&isa.bits, 
+                                            oldisa.bits, newisa.bits));
+            return false;
+        }
+    }
+
+#if SUPPORT_BIASED_REFCOUNTS
+    if (BiasedRefcounts  &&  sidetable_deferBiasedRelease_nolock()) {
+        return false;
+    }
+#endif
+
+    oldisa = LoadExclusive(&isa.bits);
+    newisa = oldisa;
+    if (newisa.extra_rc != 0) {
+        // Retained meanwhile.
+        ClearExclusive(&isa.bits);
+        goto retry;
+    }
+    if (newisa.deallocating) {
+        ClearExclusive(&isa.bits);
+        return overrelease_error();
+        // does not actually return
+    }
+    newisa.deallocating = true;
+    if (!StoreExclusive(&isa.bits, oldisa.bits, newisa.bits)) goto retry;
+    return true;
+
+ raw:
+#endif
+    RefcountMap::iterator it = table.refcnts.find(this);
+#if SUPPORT_BIASED_REFCOUNTS
+    if (BiasedRefcounts  &&  
+        (it == table.refcnts.end()  ||  it->second < SIDE_TABLE_DEALLOCATING)
+        &&  sidetable_deferBiasedRelease_nolock())
+    {
+        return false;
+    }
+#endif
+    if (it == table.refcnts.end()) {
+        table.refcnts[this] = SIDE_TABLE_DEALLOCATING;
+        return true;
+    } else if (it->second < SIDE_TABLE_DEALLOCATING) {
+        // SIDE_TABLE_WEAKLY_REFERENCED may be set. Don't change it.
+        it->second |= SIDE_TABLE_DEALLOCATING;
+        return true;
+    } else if (! (it->second & SIDE_TABLE_RC_PINNED)) {
+        it->second -= SIDE_TABLE_RC_ONE;
+    }
+    return false;
+}
+
+
+// Retains or releases the objects in batch, grouped by side table, 
+// then deallocates any released objects that need it in batch order.
+static void
+batch_flush(batch_entry_t *batch, size_t count, bool release)
+{
+    std::sort(batch, batch + count);
+
+    size_t deallocCount = 0;
+    SideTable *locked = nil;
+    for (size_t i = 0; i < count; i++) {
+        if (batch[i].table != locked) {
+            if (locked) locked->unlock();
+            locked = batch[i].table;
+            locked->lock();
+        }
+        if (!release) {
+            batch[i].obj->batchRetain_nolock();
+        } else if (batch[i].obj->batchRelease_nolock()) {
+            batch[deallocCount++] = batch[i];
+        }
+    }
+    if (locked) locked->unlock();
+
+    if (deallocCount == 0) return;
+    __sync_synchronize();
+    std::sort(batch, batch + deallocCount, batch_index_less);
+    for (size_t i = 0; i < deallocCount; i++) {
+        ((void(*)(objc_object *, SEL))objc_msgSend)(batch[i].obj, SEL_dealloc);
+    }
+}
+
+
+static void
+batch_retainOrRelease(id *objects, size_t count, bool release)
+{
+    batch_entry_t batch[BatchSideTableCount];
+    size_t batchCount = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (i + BatchPrefetchDistance < count) {
+            id ahead = objects[i + BatchPrefetchDistance];
+            if (ahead  &&  !ahead->isTaggedPointer()) {
+                __builtin_prefetch(ahead, 1);
+            }
+        }
+
+        id obj = objects[i];
+        if (!obj  ||  obj->isTaggedPointer()) continue;
+
+        // Releases below may deallocate right away. Flush the batch 
+        // first so that deallocation keeps the order of objects.
+        if (obj->ISA()->hasCustomRR()) {
+            if (release) {
+                if (batchCount) batch_flush(batch, batchCount, release);
+                batchCount = 0;
+                obj->release();
+            }
+            else obj->retain();
+            continue;
+        }
+
+#if SUPPORT_BIASED_REFCOUNTS
+        // Objects biased to this thread need no atomics at all.
+        if (slowpath(BiasedRefcounts)  &&  biasedEntry(obj)) {
+            if (release) {
+                if (batchCount) batch_flush(batch, batchCount, release);
+                batchCount = 0;
+                obj->rootRelease();
+            }
+            else obj->rootRetain();
+            continue;
+        }
+#endif
+
+        if (release ? obj->batchRelease_inline() : obj->batchRetain_inline()) {
+            continue;
+        }
+
+        batch[batchCount].table = &SideTables()[obj];
+        batch[batchCount].obj = obj;
+        batch[batchCount].index = batchCount;
+        if (++batchCount == BatchSideTableCount) {
+            batch_flush(batch, batchCount, release);
+            batchCount = 0;
+        }
+    }
+
+    if (batchCount) batch_flush(batch, batchCount, release);
+}
+
+
+void
+objc_retainArray(id *objects, size_t count)
+{
+    batch_retainOrRelease(objects, count, false);
+}
+
+
+void
+objc_releaseArray(id *objects, size_t count)
+{
+    batch_retainOrRelease(objects, count, true);
+}
+
+
+// Objects are not return values here, so the return value handshake 
+// in rootAutorelease() never applies. Immortal objects are skipped 
+// as rootAutorelease() would. Everything else is queued and added 
+// to the pool in bulk; objects with custom RR flush the queue first 
+// so the pool keeps the caller's order.
+void
+objc_autoreleaseArray(id *objects, size_t count)
+{
+    id batch[BatchSideTableCount];
+    size_t batchCount = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        id obj = objects[i];
+        if (!obj  ||  obj->isTaggedPointer()) continue;
+
+        if (obj->ISA()->hasCustomRR()) {
+            AutoreleasePoolPage::autoreleaseArray(batch, batchCount);
+            batchCount = 0;
+            obj->autorelease();
+            continue;
+        }
+
+        if (obj->isImmortal()) continue;
+
+        batch[batchCount++] = obj;
+        if (batchCount == BatchSideTableCount) {
+            AutoreleasePoolPage::autoreleaseArray(batch, batchCount);
+            batchCount = 0;
+        }
+    }
+
+    AutoreleasePoolPage::autoreleaseArray(batch, batchCount);
+}
+
+
 // OBJC2
 #else
 // not OBJC2
@@ -1617,10 +3401,35 @@ id objc_retain(id obj) { return [obj retain]; }
 void objc_release(id obj) { [obj release]; }
 id objc_autorelease(id obj) { return [obj autorelease]; }
 
+void objc_retainArray(id *objects, size_t count) {
+    for (size_t i = 0; i < count; i++) [objects[i] retain];
+}
+void objc_releaseArray(id *objects, size_t count) {
+    for (size_t i = 0; i < count; i++) [objects[i] release];
+}
+void objc_autoreleaseArray(id *objects, size_t count) {
+    for (size_t i = 0; i < count; i++) [objects[i] autorelease];
+}
+
 
 #endif
 
 
+/***********************************************************************
+* objc_setImmortal
+* Makes obj immortal: it is never deallocated, and retain, release 
+* and autorelease do nothing, without writing to obj or its side table. 
+* Objects of classes with custom retain/release still get the messages.
+* This cannot be undone.
+**********************************************************************/
+void
+objc_setImmortal(id obj)
+{
+    if (!obj  ||  obj->isTaggedPointer()) return;
+    obj->setImmortal();
+}
+
+
 /***********************************************************************
 * Basic operations for root class implementations a.k.a. _objc_root*()
 **********************************************************************/
@@ -1850,6 +3659,12 @@ _objc_autoreleasePoolPrint(void)
     AutoreleasePoolPage::printAll();
 }
 
+void
+objc_getAutoreleasePoolStatistics(objc_autorelease_pool_statistics_t *outStats)
+{
+    if (outStats) AutoreleasePoolPage::getStatistics(outStats);
+}
+
 
 // Same as objc_release but suitable for tail-calling 
 // if you need the value back and don't want to push a frame before this point.
@@ -1936,6 +3751,9 @@ void arr_init(void)
 {
     AutoreleasePoolPage::init();
     SideTableInit();
+#if SUPPORT_BIASED_REFCOUNTS
+    pthread_key_init_np(BIASED_RC_KEY, &biased_table_dealloc);
+#endif
 }
 
 
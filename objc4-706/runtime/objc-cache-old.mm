@@ -336,6 +336,15 @@ static void _cache_free_block(void *block)
 }
 
 
+/***********************************************************************
+* cache_init.
+* Nothing to do. Cache garbage is reclaimed by _collecting_in_critical().
+**********************************************************************/
+void cache_init(void)
+{
+}
+
+
 /***********************************************************************
 * _cache_free.
 *
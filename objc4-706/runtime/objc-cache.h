@@ -12,10 +12,26 @@ extern void cache_fill(Class cls, SEL sel, IMP imp, id receiver);
 
 extern void cache_erase_nolock(Class cls);
 
+extern void cache_erase_sel_nolock(Class cls, SEL sel);
+
+extern void cache_erase_sels_nolock(Class cls, const SEL *sels, size_t count);
+
 extern void cache_delete(Class cls);
 
 extern void cache_collect(bool collectALot);
 
+#if SUPPORT_CACHE_READER_EPOCHS
+// Threads without a cache reader record miss in every cache.
+// Call this before filling or reading caches on behalf of this thread.
+extern void _cache_reader_register(void);
+static inline void cache_reader_register(void)
+{
+    if (slowpath(!tls_get_direct(CACHE_READER_KEY))) _cache_reader_register();
+}
+#else
+static inline void cache_reader_register(void) { }
+#endif
+
 __END_DECLS
 
 #endif
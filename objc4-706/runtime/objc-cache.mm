@@ -52,19 +52,30 @@
  * that could have had access to the garbage has finished or moved past the 
  * cache lookup stage, so it is safe to free the memory.
  *
- * All functions that modify cache data or structures must acquire the 
- * cacheUpdateLock to prevent interference from concurrent modifications.
+ * With SUPPORT_CACHE_READER_EPOCHS the PC check is replaced by per-thread 
+ * cache reader generations. See "Cache reader generations" below.
+ *
+ * A fill into a cache with room inserts with compare-and-swap instead of 
+ * taking the cacheUpdateLock (see cache_reserve() and cache_insert()). 
+ * Such a fill writes to buckets that may already be garbage, so it 
+ * counts itself in cacheFillsInProgress and the collector waits for it 
+ * as for a reader. With SUPPORT_CACHE_READER_EPOCHS it is covered by 
+ * its thread's reader generation instead.
+ *
+ * All other functions that modify cache data or structures must acquire 
+ * the cacheUpdateLock to prevent interference from concurrent modifications.
  * The function that frees cache garbage must acquire the cacheUpdateLock 
  * and use collecting_in_critical() to flush out cache readers.
  * The cacheUpdateLock is also used to protect the custom allocator used 
  * for large method cache blocks.
  *
- * Cache readers (PC-checked by collecting_in_critical())
+ * Cache readers (PC-checked by collecting_in_critical(), 
+ *                or generation-checked by cache_readers_advanced())
  * objc_msgSend*
  * cache_getImp
  *
  * Cache writers (hold cacheUpdateLock while reading or writing; not PC-checked)
- * cache_fill         (acquires lock)
+ * cache_fill         (acquires lock, or none if the cache has room)
  * cache_expand       (only called from cache_fill)
  * cache_create       (only called from cache_expand)
  * bcopy               (only called from instrumented cache_expand)
@@ -85,6 +96,7 @@
 
 #include "objc-private.h"
 #include "objc-cache.h"
+#include "llvm-DenseMap.h"
 
 
 /* Initial cache bucket count. INIT_CACHE_SIZE must be a power of two. */
@@ -96,6 +108,7 @@ enum {
 static void cache_collect_free(struct bucket_t *data, mask_t capacity);
 static int _collecting_in_critical(void);
 static void _garbage_make_room(void);
+static bool cache_fill_concurrent(Class cls, SEL sel, IMP imp);
 
 
 /***********************************************************************
@@ -104,6 +117,9 @@ static void _garbage_make_room(void);
 static unsigned int cache_counts[16];
 static size_t cache_allocations;
 static size_t cache_collections;
+static size_t cache_fills;
+static size_t cache_migrations;
+static size_t cache_migrated_entries;
 
 static void recordNewCache(mask_t capacity)
 {
@@ -122,6 +138,54 @@ static void recordDeadCache(mask_t capacity)
     }
 }
 
+/***********************************************************************
+* Per-class cache statistics for OBJC_RECORD_CACHE_STATISTICS
+* Reported by objc_copyMethodCacheStatistics().
+* Cache locks: cacheUpdateLock protects the statistics table.
+**********************************************************************/
+struct cache_stats_t {
+    uint64_t fills;
+    uint64_t expansions;
+    uint64_t erases;
+    uint64_t totalProbes;
+    uint32_t maxProbes;
+};
+
+static objc::DenseMap<Class, cache_stats_t> *cache_stats;
+
+static cache_stats_t& cacheStatsForClass(Class cls)
+{
+    cacheUpdateLock.assertLocked();
+
+    if (!cache_stats) cache_stats = new objc::DenseMap<Class, cache_stats_t>;
+    return (*cache_stats)[cls];
+}
+
+static void recordCacheFill(Class cls, mask_t probes)
+{
+    cache_stats_t& stats = cacheStatsForClass(cls);
+    stats.fills++;
+    stats.totalProbes += probes;
+    if (probes > stats.maxProbes) stats.maxProbes = probes;
+}
+
+static void recordCacheExpansion(Class cls)
+{
+    cacheStatsForClass(cls).expansions++;
+}
+
+static void recordCacheErase(Class cls)
+{
+    cacheStatsForClass(cls).erases++;
+}
+
+static void recordCacheDelete(Class cls)
+{
+    cacheUpdateLock.assertLocked();
+    if (cache_stats) cache_stats->erase(cls);
+}
+
+
 /***********************************************************************
 * Pointers used by compiled class objects
 * These use asm to avoid conflicts with the compiler's internal declarations
@@ -173,6 +237,17 @@ static inline mask_t cache_next(mask_t i, mask_t mask) {
 #endif
 
 
+// Number of cache_next() steps from the hash slot begin to slot i.
+static inline mask_t cache_probe_distance(mask_t begin, mask_t i, mask_t mask)
+{
+#if CACHE_END_MARKER
+    return (i - begin) & mask;
+#else
+    return (begin - i) & mask;
+#endif
+}
+
+
 // copied from dispatch_atomic_maximally_synchronizing_barrier
 // fixme verify that this barrier hack does in fact work here
 #if __x86_64__
@@ -233,6 +308,7 @@ static inline mask_t cache_hash(cache_key_t key, mask_t mask)
     return (mask_t)(key & mask);
 }
 
+
 cache_t *getCache(Class cls) 
 {
     assert(cls);
@@ -245,11 +321,53 @@ cache_key_t getKey(SEL sel)
     return (cache_key_t)sel;
 }
 
+
+// Key of a bucket whose entry was removed by cache_erase_sel_nolock().
+// It matches no selector and is neither empty nor an end marker, so 
+// cache readers skip it and probe sequences through it stay intact.
+#define CACHE_KEY_INVALID (~(cache_key_t)0)
+
+
+// Key of a bucket claimed by a lock-free fill whose imp is not yet 
+// written. Cache readers skip it like an invalid bucket, but fills 
+// don't reuse it.
+#define CACHE_KEY_CLAIMED (~(cache_key_t)1)
+
+// Lock-free fills reserve a slot by incrementing _occupied with a 
+// compare-and-swap of the whole mask/occupied word, so the mask they 
+// insert with is the one their slot was counted against.
+// While a cache's buckets are being replaced the word is frozen: 
+// _occupied is CACHE_OCCUPIED_FROZEN and no reservation can succeed.
+#define CACHE_OCCUPIED_FROZEN ((mask_t)~0)
+
+#if __LP64__
+typedef uint64_t cache_word_t;
+#else
+typedef uint32_t cache_word_t;
+#endif
+#define CACHE_OCCUPIED_SHIFT (8 * sizeof(mask_t))
+
+STATIC_ASSERT(sizeof(cache_word_t) == 2 * sizeof(mask_t));
+STATIC_ASSERT(offsetof(cache_t, _occupied) == 
+              offsetof(cache_t, _mask) + sizeof(mask_t));
+STATIC_ASSERT(offsetof(cache_t, _mask) % sizeof(cache_word_t) == 0);
+
+static inline volatile cache_word_t *cache_word(cache_t *cache)
+{
+    return (volatile cache_word_t *)&cache->_mask;
+}
+
+static inline cache_word_t cache_word_make(mask_t mask, mask_t occupied)
+{
+    return (cache_word_t)mask | 
+        ((cache_word_t)occupied << CACHE_OCCUPIED_SHIFT);
+}
+
 #if __arm64__
 
 void bucket_t::set(cache_key_t newKey, IMP newImp)
 {
-    assert(_key == 0  ||  _key == newKey);
+    assert(_key == 0  ||  _key == newKey  ||  _key == CACHE_KEY_CLAIMED);
 
     // LDP/STP guarantees that all observers get 
     // either key/imp or newKey/newImp
@@ -260,7 +378,7 @@ void bucket_t::set(cache_key_t newKey, IMP newImp)
 
 void bucket_t::set(cache_key_t newKey, IMP newImp)
 {
-    assert(_key == 0  ||  _key == newKey);
+    assert(_key == 0  ||  _key == newKey  ||  _key == CACHE_KEY_CLAIMED);
 
     // objc_msgSend uses key and imp with no locks.
     // It is safe for objc_msgSend to see new imp but NULL key
@@ -278,7 +396,8 @@ void bucket_t::set(cache_key_t newKey, IMP newImp)
 
 #endif
 
-void cache_t::setBucketsAndMask(struct bucket_t *newBuckets, mask_t newMask)
+void cache_t::setBucketsAndMask(struct bucket_t *newBuckets, mask_t newMask, 
+                                mask_t newOccupied)
 {
     // objc_msgSend uses mask and buckets with no locks.
     // It is safe for objc_msgSend to see new buckets but old mask.
@@ -287,6 +406,13 @@ void cache_t::setBucketsAndMask(struct bucket_t *newBuckets, mask_t newMask)
     // Therefore we write new buckets, wait a lot, then write new mask.
     // objc_msgSend reads mask first, then buckets.
 
+    // Lock-free fills must not reserve a slot in the old buckets and 
+    // then insert into the new ones uncounted. Freeze the word until 
+    // the new buckets are in place. See cache_reserve().
+    cacheUpdateLock.assertLocked();
+    __sync_fetch_and_or(cache_word(this), 
+                        cache_word_make(0, CACHE_OCCUPIED_FROZEN));
+
     // ensure other threads see buckets contents before buckets pointer
     mega_barrier();
 
@@ -295,8 +421,7 @@ void cache_t::setBucketsAndMask(struct bucket_t *newBuckets, mask_t newMask)
     // ensure other threads see new buckets before new mask
     mega_barrier();
     
-    _mask = newMask;
-    _occupied = 0;
+    *cache_word(this) = cache_word_make(newMask, newOccupied);
 }
 
 
@@ -444,6 +569,45 @@ bool cache_t::canBeFreed()
 }
 
 
+/***********************************************************************
+* cache_migrate.  Insert every entry of oldBuckets into newBuckets.
+* newBuckets must be empty and not yet visible to cache readers.
+* Returns the number of entries inserted.
+* Cache locks: cacheUpdateLock must be held by the caller.
+**********************************************************************/
+static mask_t cache_migrate(bucket_t *oldBuckets, mask_t oldCapacity, 
+                            bucket_t *newBuckets, mask_t newCapacity)
+{
+    cacheUpdateLock.assertLocked();
+    assert(newCapacity >= oldCapacity);
+
+    mask_t newMask = newCapacity - 1;
+    mask_t count = 0;
+
+    for (mask_t i = 0; i < oldCapacity; i++) {
+        cache_key_t key = oldBuckets[i].key();
+        if (key == 0  ||  key == CACHE_KEY_INVALID  ||  
+            key == CACHE_KEY_CLAIMED) continue;
+        // Lock-free fills may still be writing to the old buckets. 
+        // Claimed buckets were skipped above. Read the imp 
+        // no earlier than the key that published it.
+        __asm__ __volatile__ ("" : : : "memory");
+
+        // The new table is no smaller than the old one, 
+        // which was never allowed to fill, so there is an empty slot.
+        mask_t j = cache_hash(key, newMask);
+        while (newBuckets[j].key() != 0) j = cache_next(j, newMask);
+
+        // Nobody can see newBuckets yet. No barriers required.
+        newBuckets[j].setImp(oldBuckets[i].imp());
+        newBuckets[j].setKey(key);
+        count++;
+    }
+
+    return count;
+}
+
+
 void cache_t::reallocate(mask_t oldCapacity, mask_t newCapacity)
 {
     bool freeOld = canBeFreed();
@@ -451,14 +615,23 @@ void cache_t::reallocate(mask_t oldCapacity, mask_t newCapacity)
     bucket_t *oldBuckets = buckets();
     bucket_t *newBuckets = allocateBuckets(newCapacity);
 
-    // Cache's old contents are not propagated. 
-    // This is thought to save cache memory at the cost of extra cache fills.
-    // fixme re-measure this
+    // Cache's old contents are not propagated unless OBJC_MIGRATE_CACHES 
+    // is set. This is thought to save cache memory at the cost of extra 
+    // cache fills. Use OBJC_PRINT_CACHE_SETUP to compare fill counts.
+    mask_t newOccupied = 0;
+    if (MigrateCaches  &&  freeOld) {
+        newOccupied = 
+            cache_migrate(oldBuckets, oldCapacity, newBuckets, newCapacity);
+        if (PrintCaches) {
+            cache_migrations++;
+            cache_migrated_entries += newOccupied;
+        }
+    }
 
     assert(newCapacity > 0);
     assert((uintptr_t)(mask_t)(newCapacity-1) == newCapacity-1);
 
-    setBucketsAndMask(newBuckets, newCapacity - 1);
+    setBucketsAndMask(newBuckets, newCapacity - 1, newOccupied);
     
     if (freeOld) {
         cache_collect_free(oldBuckets, oldCapacity);
@@ -494,12 +667,10 @@ void cache_t::bad_cache(id receiver, SEL sel, Class isa)
 }
 
 
-bucket_t * cache_t::find(cache_key_t k, id receiver)
+// Returns the first bucket in k's probe sequence that is empty or 
+// holds k, or nil if there is none.
+static bucket_t *cache_scan(bucket_t *b, mask_t m, cache_key_t k)
 {
-    assert(k != 0);
-
-    bucket_t *b = buckets();
-    mask_t m = mask();
     mask_t begin = cache_hash(k, m);
     mask_t i = begin;
     do {
@@ -508,6 +679,17 @@ bucket_t * cache_t::find(cache_key_t k, id receiver)
         }
     } while ((i = cache_next(i, m)) != begin);
 
+    return nil;
+}
+
+
+bucket_t * cache_t::find(cache_key_t k, id receiver)
+{
+    assert(k != 0);
+
+    bucket_t *bucket = cache_scan(buckets(), mask(), k);
+    if (bucket) return bucket;
+
     // hack
     Class cls = (Class)((uintptr_t)this - offsetof(objc_class, cache));
     cache_t::bad_cache(receiver, (SEL)k, cls);
@@ -531,6 +713,170 @@ void cache_t::expand()
 }
 
 
+/***********************************************************************
+* cache_reserve.
+* Count one more occupied bucket in cache, unless that would make it 
+* more than 3/4 full. Returns the buckets and mask the slot belongs to.
+* Returns false if the cache is empty, full, or being replaced.
+* Empty caches may be the shared read-only empty buckets, so their 
+* first entry is always added with cacheUpdateLock held.
+* Cache locks: cacheUpdateLock may or may not be held. If it is not, 
+* the caller must be counted as a lock-free fill (see cache_fill_concurrent()).
+**********************************************************************/
+static bool cache_reserve(cache_t *cache, bucket_t **outBuckets, 
+                          mask_t *outMask)
+{
+    while (true) {
+        cache_word_t word = *cache_word(cache);
+        mask_t mask = (mask_t)word;
+        mask_t occupied = (mask_t)(word >> CACHE_OCCUPIED_SHIFT);
+
+        // Frozen caches look full.
+        uint32_t capacity = (uint32_t)mask + 1;
+        if (occupied == 0  ||  occupied >= capacity / 4 * 3) return false;
+
+        // The buckets are never older than the word.
+        __asm__ __volatile__ ("" : : : "memory");
+        bucket_t *buckets = cache->buckets();
+
+        if (!__sync_bool_compare_and_swap(cache_word(cache), word, 
+                                          cache_word_make(mask, occupied+1)))
+        {
+            continue;
+        }
+
+        // The word is frozen whenever the buckets change, so the 
+        // reservation counts against these buckets if they are still 
+        // installed. Buckets are not reused while we are a cache reader.
+        // If they were replaced, the stray count is dropped with them.
+        if (cache->buckets() != buckets) return false;
+
+        *outBuckets = buckets;
+        *outMask = mask;
+        return true;
+    }
+}
+
+
+/***********************************************************************
+* cache_unreserve.
+* Give back a slot reserved with cache_reserve() that the insert did 
+* not need. If the buckets were replaced, the count went with them.
+* Cache locks: as for cache_reserve().
+**********************************************************************/
+static void cache_unreserve(cache_t *cache, bucket_t *buckets, mask_t mask)
+{
+    while (true) {
+        cache_word_t word = *cache_word(cache);
+        mask_t occupied = (mask_t)(word >> CACHE_OCCUPIED_SHIFT);
+        if ((mask_t)word != mask  ||  occupied == CACHE_OCCUPIED_FROZEN  ||  
+            occupied == 0)
+        {
+            return;
+        }
+
+        // Replacing the buckets changes the word first.
+        __asm__ __volatile__ ("" : : : "memory");
+        if (cache->buckets() != buckets) return;
+
+        if (__sync_bool_compare_and_swap(cache_word(cache), word, 
+                                         cache_word_make(mask, occupied-1)))
+        {
+            return;
+        }
+    }
+}
+
+
+/***********************************************************************
+* cache_insert.
+* Add key/imp to buckets in a slot reserved with cache_reserve().
+* Concurrent inserts claim a bucket with a compare-and-swap, then 
+* publish the imp before the key as bucket_t::set() always does.
+* 
+* An insert reuses the first bucket in key's probe sequence that was 
+* invalidated by cache_erase_sel_nolock() or by a duplicate removal 
+* below. Such a bucket is already counted in occupied, so the 
+* reservation is given back. Otherwise the insert claims the empty 
+* bucket that ends the probe sequence.
+* 
+* Two threads filling the same key may claim different buckets, because 
+* a scan skips a claimed bucket without knowing its key. After claiming, 
+* the key is looked up again. If it was filled meanwhile, the claim is 
+* abandoned and the bucket invalidated. Claimed buckets are skipped by 
+* cache readers, so probe sequences through them stay intact. After 
+* publishing, every inserter fences and scans the whole probe sequence, 
+* then invalidates every copy of key except the first. Of two racing 
+* inserters, at least one sees the other's key, so no duplicate survives.
+* Returns the bucket holding key, or nil if the buckets are corrupt.
+* Cache locks: as for cache_reserve().
+**********************************************************************/
+static bucket_t *cache_insert(cache_t *cache, bucket_t *buckets, mask_t mask, 
+                              cache_key_t key, IMP imp)
+{
+    bucket_t *bucket;
+    bool reused;
+    while (true) {
+        // Find key, the first invalid bucket, and the empty bucket 
+        // that ends key's probe sequence.
+        bucket_t *invalid = nil;
+        bucket = nil;
+        mask_t begin = cache_hash(key, mask);
+        mask_t i = begin;
+        do {
+            cache_key_t k = buckets[i].key();
+            if (k == key) {
+                // Another thread filled the same entry first.
+                cache_unreserve(cache, buckets, mask);
+                return &buckets[i];
+            }
+            if (k == 0) {
+                bucket = &buckets[i];
+                break;
+            }
+            if (k == CACHE_KEY_INVALID  &&  !invalid) invalid = &buckets[i];
+        } while ((i = cache_next(i, mask)) != begin);
+
+        reused = (invalid != nil);
+        if (reused) bucket = invalid;
+        else if (!bucket) return nil;
+
+        if (bucket->claimKey(reused ? CACHE_KEY_INVALID : 0, 
+                             CACHE_KEY_CLAIMED)) 
+        {
+            break;
+        }
+        // Another thread claimed this bucket first. Scan again.
+    }
+    if (reused) cache_unreserve(cache, buckets, mask);
+
+    // Did another thread fill key past our claim?
+    bucket_t *other = cache_scan(buckets, mask, key);
+    if (other  &&  other->key() == key) {
+        bucket->setKey(CACHE_KEY_INVALID);
+        return other;
+    }
+
+    bucket->set(key, imp);
+
+    // Another thread may be publishing key in a different bucket now.
+    OSMemoryBarrier();
+
+    bucket_t *first = nil;
+    mask_t begin = cache_hash(key, mask);
+    mask_t i = begin;
+    do {
+        cache_key_t k = buckets[i].key();
+        if (k == 0) break;
+        if (k != key) continue;
+        if (!first) first = &buckets[i];
+        else buckets[i].setKey(CACHE_KEY_INVALID);
+    } while ((i = cache_next(i, mask)) != begin);
+
+    return first ?: bucket;
+}
+
+
 static void cache_fill_nolock(Class cls, SEL sel, IMP imp, id receiver)
 {
     cacheUpdateLock.assertLocked();
@@ -545,32 +891,45 @@ static void cache_fill_nolock(Class cls, SEL sel, IMP imp, id receiver)
     cache_t *cache = getCache(cls);
     cache_key_t key = getKey(sel);
 
-    // Use the cache as-is if it is less than 3/4 full
-    mask_t newOccupied = cache->occupied() + 1;
-    mask_t capacity = cache->capacity();
-    if (cache->isConstantEmptyCache()) {
-        // Cache is read-only. Replace it.
-        cache->reallocate(capacity, capacity ?: INIT_CACHE_SIZE);
-    }
-    else if (newOccupied <= capacity / 4 * 3) {
-        // Cache is less than 3/4 full. Use it as-is.
-    }
-    else {
+    if (PrintCaches) cache_fills++;
+
+    // Lock-free fills may be inserting into this cache concurrently.
+    // Reserve a slot the same way they do. They never reserve in an 
+    // empty cache, which may be read-only, so its first slot is ours.
+    bucket_t *buckets;
+    mask_t m;
+    while (!cache_reserve(cache, &buckets, &m)) {
+        if (cache->occupied() == 0) {
+            if (cache->isConstantEmptyCache()) {
+                // Cache is read-only. Replace it.
+                mask_t capacity = cache->capacity();
+                cache->reallocate(capacity, capacity ?: INIT_CACHE_SIZE);
+            }
+            buckets = cache->buckets();
+            m = cache->mask();
+            __sync_fetch_and_add(cache_word(cache), cache_word_make(0, 1));
+            break;
+        }
+
         // Cache is too full. Expand it.
         cache->expand();
+        if (RecordCacheStatistics) recordCacheExpansion(cls);
     }
 
-    // Scan for the first unused slot and insert there.
-    // There is guaranteed to be an empty slot because the 
-    // minimum size is 4 and we resized at 3/4 full.
-    bucket_t *bucket = cache->find(key, receiver);
-    if (bucket->key() == 0) cache->incrementOccupied();
-    bucket->set(key, imp);
+    bucket_t *bucket = cache_insert(cache, buckets, m, key, imp);
+    if (!bucket) cache_t::bad_cache(receiver, sel, cls);
+
+    if (RecordCacheStatistics) {
+        mask_t probes = cache_probe_distance(cache_hash(key, m), 
+                                             (mask_t)(bucket - buckets), m);
+        recordCacheFill(cls, probes);
+    }
 }
 
 void cache_fill(Class cls, SEL sel, IMP imp, id receiver)
 {
 #if !DEBUG_TASK_THREADS
+    if (cache_fill_concurrent(cls, sel, imp)) return;
     mutex_locker_t lock(cacheUpdateLock);
     cache_fill_nolock(cls, sel, imp, receiver);
 #else
@@ -596,6 +955,73 @@ void cache_erase_nolock(Class cls)
 
         cache_collect_free(oldBuckets, capacity);
         cache_collect(false);
+
+        if (RecordCacheStatistics) recordCacheErase(cls);
+    }
+}
+
+
+/***********************************************************************
+* cache_erase_sel_nolock.
+* Remove any entries for sel from cls's cache, keeping all others.
+* The buckets are marked CACHE_KEY_INVALID rather than emptied so that 
+* probe sequences passing through them stay intact. They stay counted 
+* in occupied, because they still lengthen probe sequences, until a 
+* fill reuses them (see cache_insert()) or the cache is replaced.
+* Cache locks: cacheUpdateLock must be held by the caller.
+* The caller must also hold runtimeLock for writing, so no fill 
+* of sel with an outdated imp is in progress.
+**********************************************************************/
+void cache_erase_sel_nolock(Class cls, SEL sel)
+{
+    cacheUpdateLock.assertLocked();
+
+    cache_t *cache = getCache(cls);
+    if (cache->occupied() == 0) return;
+
+    bucket_t *b = cache->buckets();
+    mask_t m = cache->mask();
+    cache_key_t key = getKey(sel);
+    mask_t begin = cache_hash(key, m);
+    mask_t i = begin;
+    do {
+        cache_key_t k = b[i].key();
+        if (k == 0) break;
+        if (k == key) b[i].setKey(CACHE_KEY_INVALID);
+    } while ((i = cache_next(i, m)) != begin);
+}
+
+
+/***********************************************************************
+* cache_erase_sels_nolock.
+* Like cache_erase_sel_nolock() for every selector in sels, which must 
+* be sorted by address. Costs one pass over cls's buckets.
+* Cache locks: cacheUpdateLock must be held by the caller.
+**********************************************************************/
+void cache_erase_sels_nolock(Class cls, const SEL *sels, size_t count)
+{
+    cacheUpdateLock.assertLocked();
+
+    cache_t *cache = getCache(cls);
+    if (cache->occupied() == 0  ||  count == 0) return;
+
+    bucket_t *b = cache->buckets();
+    mask_t capacity = cache->capacity();
+    for (mask_t i = 0; i < capacity; i++) {
+        cache_key_t k = b[i].key();
+        if (k == 0  ||  k == CACHE_KEY_INVALID) continue;
+
+        size_t lo = 0, hi = count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            cache_key_t midKey = getKey(sels[mid]);
+            if (midKey == k) {
+                b[i].setKey(CACHE_KEY_INVALID);
+                break;
+            }
+            if (midKey < k) lo = mid + 1;
+            else hi = mid;
+        }
     }
 }
 
@@ -607,6 +1033,394 @@ void cache_delete(Class cls)
         if (PrintCaches) recordDeadCache(cls->cache.capacity());
         free(cls->cache.buckets());
     }
+    if (RecordCacheStatistics) recordCacheDelete(cls);
+}
+
+
+/***********************************************************************
+* objc_copyMethodCacheStatistics
+* Returns a malloc'd snapshot of the statistics recorded for every class 
+* whose cache was filled while OBJC_RECORD_CACHE_STATISTICS was set.
+* Locking: acquires cacheUpdateLock
+**********************************************************************/
+objc_method_cache_statistics_t *
+objc_copyMethodCacheStatistics(unsigned int *outCount)
+{
+    unsigned int count = 0;
+    objc_method_cache_statistics_t *result = nil;
+
+    if (RecordCacheStatistics) {
+        mutex_locker_t lock(cacheUpdateLock);
+
+        if (cache_stats  &&  cache_stats->size() > 0) {
+            result = (objc_method_cache_statistics_t *)
+                calloc(cache_stats->size(), sizeof(*result));
+            for (auto& pair : *cache_stats) {
+                Class cls = pair.first;
+                const cache_stats_t& stats = pair.second;
+                objc_method_cache_statistics_t& out = result[count++];
+                out.cls = cls;
+                out.fills = stats.fills;
+                out.expansions = stats.expansions;
+                out.erases = stats.erases;
+                out.totalProbes = stats.totalProbes;
+                out.maxProbes = stats.maxProbes;
+                out.occupied = cls->cache.occupied();
+                out.capacity = cls->cache.capacity();
+            }
+        }
+    }
+
+    if (outCount) *outCount = count;
+    return result;
+}
+
+
+/***********************************************************************
+* Cache reader generations.
+* 
+* Each thread that reads method caches owns a cache_reader_t, found via 
+* CACHE_READER_KEY. The messenger increments the record's generation 
+* before it loads a class's buckets and increments it again after it 
+* has finished with them, so the generation is odd exactly while the 
+* thread may hold a pointer into some bucket array. A thread without 
+* a record misses in every cache; lookUpImpOrForward() registers one.
+*
+* To collect garbage, the collector snapshots the generation of every 
+* reader. The garbage may be freed once every reader that was odd in 
+* the snapshot has moved to a different generation. Cache readers never 
+* block, so this happens within a few instructions of the reader being 
+* scheduled, no matter how many threads are messaging at the time.
+* 
+* The messenger does not fence its increment before loading the cache. 
+* Instead the collector forces every running thread's pending stores 
+* to become visible with cache_reader_barrier() before it snapshots.
+*
+* Records are never freed. A record whose thread has exited is reused 
+* by the next thread to register.
+**********************************************************************/
+#if SUPPORT_CACHE_READER_EPOCHS
+
+struct cache_reader_t {
+    // Written only by the owning thread. 
+    // The messenger assumes this is at offset 0.
+    uintptr_t generation;
+
+    // Linked list of all records. Only ever pushed.
+    cache_reader_t *next;
+
+    // Non-zero while some thread owns this record.
+    long inUse;
+};
+
+// Each record is padded to its own cache line.
+enum { CacheReaderSize = 64 };
+STATIC_ASSERT(sizeof(cache_reader_t) <= CacheReaderSize);
+
+static cache_reader_t * volatile cacheReaders;
+
+
+static void cache_reader_destroy(void *arg)
+{
+    cache_reader_t *reader = (cache_reader_t *)arg;
+    if (!reader) return;
+
+    assert((reader->generation & 1) == 0);
+
+    // If a later TSD destructor sends a message, this thread 
+    // registers again and that record is released by a later 
+    // destructor pass.
+    OSAtomicCompareAndSwapLongBarrier(1, 0, &reader->inUse);
+}
+
+
+void _cache_reader_register(void)
+{
+    cache_reader_t *reader;
+
+    // Reuse a record abandoned by an exited thread.
+    for (reader = cacheReaders; reader; reader = reader->next) {
+        if (reader->inUse == 0  &&  
+            OSAtomicCompareAndSwapLongBarrier(0, 1, &reader->inUse)) 
+        {
+            tls_set_direct(CACHE_READER_KEY, reader);
+            return;
+        }
+    }
+
+    void *mem = nil;
+    if (posix_memalign(&mem, CacheReaderSize, CacheReaderSize) != 0) {
+        // Stay unregistered. All cache lookups on this thread miss.
+        return;
+    }
+    bzero(mem, CacheReaderSize);
+    reader = (cache_reader_t *)mem;
+    reader->inUse = 1;
+
+    cache_reader_t *head;
+    do {
+        head = cacheReaders;
+        reader->next = head;
+    } while (!OSAtomicCompareAndSwapPtrBarrier(head, reader, 
+                                               (void * volatile *)&cacheReaders));
+
+    tls_set_direct(CACHE_READER_KEY, reader);
+}
+
+
+/***********************************************************************
+* cache_reader_barrier.
+* Make every other thread's completed stores visible to this thread.
+* Removing write permission from a resident page forces a TLB shootdown 
+* on every CPU currently running a thread of this process. The 
+* interrupt drains that CPU's store buffer. Threads not running have 
+* no buffered stores.
+* 
+* If the page can't be allocated or reprotected, the barrier falls back 
+* to _collecting_in_critical(). Its thread_get_state() calls interrupt 
+* every other thread, which drains their store buffers the same way. 
+* Returns false if that fallback found a thread in objc_msgSend, in 
+* which case the barrier has not been made.
+* Cache locks: cacheUpdateLock must be held by the caller.
+**********************************************************************/
+static bool cache_reader_barrier(void)
+{
+    cacheUpdateLock.assertLocked();
+
+    static vm_address_t page;
+    static bool unavailable;
+
+    if (!page  &&  !unavailable) {
+        kern_return_t kr = 
+            vm_allocate(mach_task_self(), &page, PAGE_MAX_SIZE, 
+                        TRUE | VM_MAKE_TAG(VM_MEMORY_OBJC_DISPATCHERS));
+        if (kr != KERN_SUCCESS) {
+            if (PrintCaches) {
+                _objc_inform("CACHES: vm_allocate failed (0x%x); "
+                             "scanning thread PCs instead", kr);
+            }
+            page = 0;
+            unavailable = true;
+        }
+    }
+
+    if (!unavailable) {
+        // The page must be resident and writable for the downgrade 
+        // to require a shootdown.
+        *(volatile uintptr_t *)page = 0;
+        if (mprotect((void *)page, PAGE_MAX_SIZE, PROT_READ) == 0) {
+            if (mprotect((void *)page, PAGE_MAX_SIZE, 
+                         PROT_READ | PROT_WRITE) == 0) 
+            {
+                return true;
+            }
+            // The downgrade happened, so the barrier did too, but 
+            // the page can't be written again. Don't use it again.
+            unavailable = true;
+            return true;
+        }
+        if (PrintCaches) {
+            _objc_inform("CACHES: mprotect failed (errno %d); "
+                         "scanning thread PCs instead", errno);
+        }
+        unavailable = true;
+    }
+
+    return !_collecting_in_critical();
+}
+
+
+struct cache_reader_snapshot_t {
+    cache_reader_t *reader;
+    uintptr_t generation;
+};
+
+// readers that were inside a cache lookup when the waiting garbage 
+// was disconnected
+static cache_reader_snapshot_t *busy_readers = nil;
+static size_t busy_reader_count = 0;
+static size_t busy_reader_max = 0;
+
+
+// false if busy_readers must be recorded again before the waiting 
+// garbage can be freed
+static bool busy_readers_valid = false;
+
+
+/***********************************************************************
+* cache_readers_snapshot.  Record every reader that may currently 
+* be using garbage that has already been disconnected.
+* Returns false if no snapshot could be taken. See cache_reader_barrier().
+* Cache locks: cacheUpdateLock must be held by the caller.
+**********************************************************************/
+static bool cache_readers_snapshot(void)
+{
+    cacheUpdateLock.assertLocked();
+
+    busy_reader_count = 0;
+    busy_readers_valid = cache_reader_barrier();
+    if (!busy_readers_valid) return false;
+
+    for (cache_reader_t *reader = cacheReaders; reader; reader = reader->next)
+    {
+        uintptr_t generation = *(volatile uintptr_t *)&reader->generation;
+        if ((generation & 1) == 0) continue;
+
+        if (busy_reader_count == busy_reader_max) {
+            busy_reader_max = busy_reader_max ? busy_reader_max*2 : 16;
+            busy_readers = (cache_reader_snapshot_t *)
+                realloc(busy_readers, 
+                        busy_reader_max * sizeof(cache_reader_snapshot_t));
+        }
+        busy_readers[busy_reader_count++] = 
+            cache_reader_snapshot_t{reader, generation};
+    }
+
+    return true;
+}
+
+
+/***********************************************************************
+* cache_readers_advanced.  Returns true if every reader recorded by 
+* cache_readers_snapshot() has since left that cache lookup.
+* Readers usually leave within a few instructions, so spin briefly.
+* If wait is true, keep waiting until they have.
+* If the last snapshot failed, take it again first.
+* Cache locks: cacheUpdateLock must be held by the caller.
+**********************************************************************/
+enum { CACHE_READER_SPIN_LIMIT = 1000 };
+
+static bool cache_readers_advanced(bool wait)
+{
+    cacheUpdateLock.assertLocked();
+
+    // The garbage is already disconnected, so a later snapshot is 
+    // as good as one taken when it was disconnected.
+    while (!busy_readers_valid  &&  !cache_readers_snapshot()) {
+        if (!wait) return false;
+    }
+
+    unsigned spins = 0;
+    while (busy_reader_count > 0) {
+        cache_reader_snapshot_t& snap = busy_readers[busy_reader_count-1];
+        if (*(volatile uintptr_t *)&snap.reader->generation != snap.generation)
+        {
+            busy_reader_count--;
+            continue;
+        }
+        if (++spins < CACHE_READER_SPIN_LIMIT) continue;
+        if (!wait) return false;
+        // The reader was probably preempted mid-lookup.
+        sched_yield();
+    }
+
+    // Don't let the caller's free() move above the generation reads.
+    OSMemoryBarrier();
+    return true;
+}
+
+// SUPPORT_CACHE_READER_EPOCHS
+#endif
+
+
+#if !SUPPORT_CACHE_READER_EPOCHS
+// Lock-free fills in progress, striped by class so that fills 
+// to different classes rarely write the same cache line.
+// The collector waits for every stripe to drop to zero.
+struct alignas(64) cache_fill_count_t {
+    volatile long count;
+};
+enum { CacheFillCountStripes = 16 };
+static cache_fill_count_t cacheFillsInProgress[CacheFillCountStripes];
+
+static inline cache_fill_count_t& cache_fill_count(Class cls)
+{
+    return cacheFillsInProgress
+        [((uintptr_t)cls >> 4) % CacheFillCountStripes];
+}
+
+// Returns true if a lock-free fill may be writing to garbage.
+// Cache locks: cacheUpdateLock must be held by the caller.
+static bool cache_fills_in_progress(void)
+{
+    cacheUpdateLock.assertLocked();
+
+    // Pairs with the barrier in cache_fill_concurrent(): either the 
+    // fill sees the buckets that replaced the garbage, or we see it.
+    OSMemoryBarrier();
+    for (unsigned i = 0; i < CacheFillCountStripes; i++) {
+        if (cacheFillsInProgress[i].count) return true;
+    }
+    return false;
+}
+#endif
+
+
+/***********************************************************************
+* cache_fill_concurrent.
+* Add sel/imp to cls's cache without taking cacheUpdateLock.
+* Returns false if the fill must be done with the lock held instead: 
+* the cache is empty or must be expanded, this thread has no cache 
+* reader record, or cache instrumentation is enabled.
+* The buckets must not be freed while the fill writes to them. With 
+* SUPPORT_CACHE_READER_EPOCHS the fill runs inside this thread's cache 
+* reader critical section. Otherwise it is counted in 
+* cacheFillsInProgress, which cache_collect() waits for.
+* If the buckets are replaced meanwhile, the new entry is discarded 
+* with them.
+* Cache locks: cacheUpdateLock must not be held by the caller.
+**********************************************************************/
+static bool cache_fill_concurrent(Class cls, SEL sel, IMP imp)
+{
+    if (PrintCaches  ||  RecordCacheStatistics) return false;
+
+#if SUPPORT_CACHE_READER_EPOCHS
+    volatile cache_reader_t *reader = 
+        (volatile cache_reader_t *)tls_get_direct(CACHE_READER_KEY);
+    if (!reader) return false;
+#endif
+
+    // Never cache before +initialize is done
+    if (!cls->isInitialized()) return true;
+
+    // Make sure the entry wasn't added to the cache by some other thread.
+    // cache_getImp() enters and leaves the critical section itself.
+    if (cache_getImp(cls, sel)) return true;
+
+    bucket_t *buckets;
+    mask_t mask;
+    bucket_t *bucket = nil;
+
+#if SUPPORT_CACHE_READER_EPOCHS
+    reader->generation++;
+    __asm__ __volatile__ ("" : : : "memory");
+#else
+    // Full barrier: count ourselves before reading the buckets pointer.
+    cache_fill_count_t& fills = cache_fill_count(cls);
+    __sync_fetch_and_add(&fills.count, 1);
+#endif
+
+    cache_t *cache = getCache(cls);
+    if (cache_reserve(cache, &buckets, &mask)) {
+        bucket = cache_insert(cache, buckets, mask, getKey(sel), imp);
+    }
+
+#if SUPPORT_CACHE_READER_EPOCHS
+    __asm__ __volatile__ ("" : : : "memory");
+    reader->generation++;
+#else
+    __sync_fetch_and_sub(&fills.count, 1);
+#endif
+
+    return bucket != nil;
+}
+
+
+void cache_init(void)
+{
+#if SUPPORT_CACHE_READER_EPOCHS
+    pthread_key_init_np(CACHE_READER_KEY, &cache_reader_destroy);
+#endif
 }
 
 
@@ -766,14 +1580,20 @@ enum {
     INIT_GARBAGE_COUNT = 128
 };
 
+#if SUPPORT_CACHE_READER_EPOCHS
+// garbage disconnected before the last cache_readers_snapshot()
+// and not yet freed
+static bucket_t **waiting_garbage_refs = 0;
+static size_t waiting_garbage_count = 0;
+static size_t waiting_garbage_max = 0;
+static size_t waiting_garbage_byte_size = 0;
+#endif
+
 static void _garbage_make_room(void)
 {
-    static int first = 1;
-
     // Create the collection table the first time it is needed
-    if (first)
+    if (!garbage_refs)
     {
-        first = 0;
         garbage_refs = (bucket_t**)
             malloc(INIT_GARBAGE_COUNT * sizeof(void *));
         garbage_max = INIT_GARBAGE_COUNT;
@@ -813,18 +1633,112 @@ static void cache_collect_free(bucket_t *data, mask_t capacity)
 * collectALot tries harder to free memory.
 * Cache locks: cacheUpdateLock must be held by the caller.
 **********************************************************************/
+static void cache_collect_print(void);
+
+#if SUPPORT_CACHE_READER_EPOCHS
+
+/***********************************************************************
+* cache_collect_waiting.  Free the waiting garbage.
+* Cache locks: cacheUpdateLock must be held by the caller.
+**********************************************************************/
+static void cache_collect_waiting(void)
+{
+    cacheUpdateLock.assertLocked();
+
+    // Log our progress
+    if (PrintCaches) {
+        cache_collections++;
+        _objc_inform ("CACHES: COLLECTING %zu bytes (%zu allocations, %zu collections)", waiting_garbage_byte_size, cache_allocations, cache_collections);
+    }
+
+    // Dispose all refs now in the garbage
+    // Erase each entry so debugging tools don't see stale pointers.
+    while (waiting_garbage_count--) {
+        auto dead = waiting_garbage_refs[waiting_garbage_count];
+        waiting_garbage_refs[waiting_garbage_count] = nil;
+        free(dead);
+    }
+
+    waiting_garbage_count = 0;
+    waiting_garbage_byte_size = 0;
+
+    if (PrintCaches) cache_collect_print();
+}
+
+
+/***********************************************************************
+* cache_collect.  Try to free accumulated dead caches.
+* collectALot tries harder to free memory.
+* 
+* Garbage is freed in two phases. First the garbage is moved to the 
+* waiting list and the busy cache readers are recorded. The waiting 
+* garbage is freed once those readers have moved on, which is usually 
+* immediately and otherwise by the next call to cache_collect().
+* Cache locks: cacheUpdateLock must be held by the caller.
+**********************************************************************/
 void cache_collect(bool collectALot)
 {
     cacheUpdateLock.assertLocked();
 
+    // Free the previous batch if its readers have moved on.
+    if (waiting_garbage_count > 0) {
+        if (!cache_readers_advanced(collectALot)) {
+            if (PrintCaches) {
+                _objc_inform ("CACHES: not collecting; "
+                              "objc_msgSend in progress");
+            }
+            return;
+        }
+        cache_collect_waiting();
+    }
+
     // Done if the garbage is not full
     if (garbage_byte_size < garbage_threshold  &&  !collectALot) {
         return;
     }
+    if (garbage_count == 0) return;
+
+    // The garbage is already disconnected. It becomes the waiting batch.
+    // The now-empty waiting table becomes the garbage table.
+    std::swap(garbage_refs, waiting_garbage_refs);
+    std::swap(garbage_max, waiting_garbage_max);
+    waiting_garbage_count = garbage_count;
+    waiting_garbage_byte_size = garbage_byte_size;
+    garbage_count = 0;
+    garbage_byte_size = 0;
+
+    cache_readers_snapshot();
+    if (cache_readers_advanced(collectALot)) {
+        cache_collect_waiting();
+    } 
+    else if (PrintCaches) {
+        _objc_inform ("CACHES: deferring collection; "
+                      "objc_msgSend in progress");
+    }
+}
 
-    // Synchronize collection with objc_msgSend and other cache readers
+// SUPPORT_CACHE_READER_EPOCHS
+#else
+// !SUPPORT_CACHE_READER_EPOCHS
+
+/***********************************************************************
+* cache_collect.  Try to free accumulated dead caches.
+* collectALot tries harder to free memory.
+* Cache locks: cacheUpdateLock must be held by the caller.
+**********************************************************************/
+void cache_collect(bool collectALot)
+{
+    cacheUpdateLock.assertLocked();
+
+    // Done if the garbage is not full
+    if (garbage_byte_size < garbage_threshold  &&  !collectALot) {
+        return;
+    }
+
+    // Synchronize collection with objc_msgSend and other cache readers, 
+    // including lock-free fills
     if (!collectALot) {
-        if (_collecting_in_critical ()) {
+        if (cache_fills_in_progress()  ||  _collecting_in_critical ()) {
             // objc_msgSend (or other cache reader) is currently looking in
             // the cache and might still be using some garbage.
             if (PrintCaches) {
@@ -836,7 +1750,7 @@ void cache_collect(bool collectALot)
     } 
     else {
         // No excuses.
-        while (_collecting_in_critical()) 
+        while (cache_fills_in_progress()  ||  _collecting_in_critical()) 
             ;
     }
 
@@ -860,28 +1774,41 @@ void cache_collect(bool collectALot)
     garbage_count = 0;
     garbage_byte_size = 0;
 
-    if (PrintCaches) {
-        size_t i;
-        size_t total_count = 0;
-        size_t total_size = 0;
+    if (PrintCaches) cache_collect_print();
+}
 
-        for (i = 0; i < countof(cache_counts); i++) {
-            int count = cache_counts[i];
-            int slots = 1 << i;
-            size_t size = count * slots * sizeof(bucket_t);
+// !SUPPORT_CACHE_READER_EPOCHS
+#endif
 
-            if (!count) continue;
 
-            _objc_inform("CACHES: %4d slots: %4d caches, %6zu bytes", 
-                         slots, count, size);
+/***********************************************************************
+* cache_collect_print.  Log the live caches for OBJC_PRINT_CACHE_SETUP.
+**********************************************************************/
+static void cache_collect_print(void)
+{
+    size_t i;
+    size_t total_count = 0;
+    size_t total_size = 0;
 
-            total_count += count;
-            total_size += size;
-        }
+    for (i = 0; i < countof(cache_counts); i++) {
+        int count = cache_counts[i];
+        int slots = 1 << i;
+        size_t size = count * slots * sizeof(bucket_t);
+
+        if (!count) continue;
 
-        _objc_inform("CACHES:      total: %4zu caches, %6zu bytes", 
-                     total_count, total_size);
+        _objc_inform("CACHES: %4d slots: %4d caches, %6zu bytes", 
+                     slots, count, size);
+
+        total_count += count;
+        total_size += size;
     }
+
+    _objc_inform("CACHES:      total: %4zu caches, %6zu bytes", 
+                 total_count, total_size);
+    _objc_inform("CACHES:      fills: %zu (%zu expansions migrated "
+                 "%zu entries)", cache_fills, cache_migrations, 
+                 cache_migrated_entries);
 }
 
 
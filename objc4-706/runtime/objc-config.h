@@ -159,6 +159,49 @@
 #   define SUPPORT_QOS_HACK 1
 #endif
 
+// Define SUPPORT_CACHE_READER_EPOCHS to reclaim method cache garbage using
+// per-thread cache reader generations instead of scanning thread PCs.
+// Every objc_msgSend then pays two TSD loads and two increments, so this
+// is off unless the build defines OBJC_CACHE_READER_EPOCHS=1 (for processes 
+// with enough threads that the PC-scanning collector rarely gets to run).
+// Be sure to edit the CacheLookup macro in objc-msg-x86_64.s as well.
+#if !__OBJC2__  ||  !defined(__x86_64__)  ||  TARGET_OS_SIMULATOR  ||  \
+    !OBJC_CACHE_READER_EPOCHS
+#   define SUPPORT_CACHE_READER_EPOCHS 0
+#else
+#   define SUPPORT_CACHE_READER_EPOCHS 1
+#endif
+
+// Define SUPPORT_BIASED_REFCOUNTS to allow OBJC_BIASED_REFCOUNTS, which 
+// retains and releases an object on its allocating thread without atomics.
+// Every retain and release then tests the option, and every allocation 
+// while it is set takes a side table lock, so this is off unless the 
+// build defines OBJC_SUPPORT_BIASED_REFCOUNTS=1.
+#if !SUPPORT_NONPOINTER_ISA  ||  !OBJC_SUPPORT_BIASED_REFCOUNTS
+#   define SUPPORT_BIASED_REFCOUNTS 0
+#else
+#   define SUPPORT_BIASED_REFCOUNTS 1
+#endif
+
+// Define SUPPORT_AUTORELEASEPOOL_COALESCING to store repeated autoreleases 
+// of the same object as one autorelease pool entry with a count.
+#if !__LP64__
+#   define SUPPORT_AUTORELEASEPOOL_COALESCING 0
+#else
+#   define SUPPORT_AUTORELEASEPOOL_COALESCING 1
+#endif
+
+// Define SUPPORT_LOCK_CONTENTION_STATS to count acquisitions, contention, 
+// spins and parks in every spinlock_t for objc_copyLockContention().
+// The counters make each lock 32 bytes larger, which pushes the rest 
+// of a SideTable off the lock's cache line, so this is off unless 
+// the build defines OBJC_LOCK_CONTENTION_STATS=1.
+#if !OBJC_LOCK_CONTENTION_STATS
+#   define SUPPORT_LOCK_CONTENTION_STATS 0
+#else
+#   define SUPPORT_LOCK_CONTENTION_STATS 1
+#endif
+
 // OBJC_INSTRUMENTED controls whether message dispatching is dynamically
 // monitored.  Monitoring introduces substantial overhead.
 // NOTE: To define this condition, do so in the build command, NOT by
@@ -22,6 +22,7 @@ OPTION( PrintAltHandlers,         OBJC_PRINT_ALT_HANDLERS,         "log processi
 OPTION( PrintReplacedMethods,     OBJC_PRINT_REPLACED_METHODS,     "log methods replaced by category implementations")
 OPTION( PrintDeprecation,         OBJC_PRINT_DEPRECATION_WARNINGS, "warn about calls to deprecated runtime functions")
 OPTION( PrintPoolHiwat,           OBJC_PRINT_POOL_HIGHWATER,       "log high-water marks for autorelease pools")
+OPTION( PrintPoolStatistics,      OBJC_PRINT_POOL_STATISTICS,      "log each thread's autorelease pool statistics every few seconds (implies OBJC_RECORD_POOL_STATISTICS)")
 OPTION( PrintCustomRR,            OBJC_PRINT_CUSTOM_RR,            "log classes with un-optimized custom retain/release methods")
 OPTION( PrintCustomAWZ,           OBJC_PRINT_CUSTOM_AWZ,           "log classes with un-optimized custom allocWithZone methods")
 OPTION( PrintRawIsa,              OBJC_PRINT_RAW_ISA,              "log classes that require raw pointer isa fields")
@@ -40,3 +41,10 @@ OPTION( DisableVtables,           OBJC_DISABLE_VTABLES,            "disable vtab
 OPTION( DisablePreopt,            OBJC_DISABLE_PREOPTIMIZATION,    "disable preoptimization courtesy of dyld shared cache")
 OPTION( DisableTaggedPointers,    OBJC_DISABLE_TAGGED_POINTERS,    "disable tagged pointer optimization of NSNumber et al.") 
 OPTION( DisableNonpointerIsa,     OBJC_DISABLE_NONPOINTER_ISA,     "disable non-pointer isa fields")
+OPTION( BiasedRefcounts,          OBJC_BIASED_REFCOUNTS,           "retain and release objects without atomic operations on the thread that allocated them")
+OPTION( DisableAutoreleaseCoalescing, OBJC_DISABLE_AUTORELEASE_COALESCING, "disable storing repeated autoreleases of an object as one autorelease pool entry")
+
+OPTION( MigrateCaches,            OBJC_MIGRATE_CACHES,             "copy method cache entries into the new table when a cache grows")
+OPTION( RecordCacheStatistics,    OBJC_RECORD_CACHE_STATISTICS,    "record per-class method cache statistics for objc_copyMethodCacheStatistics()")
+OPTION( RecordPoolStatistics,     OBJC_RECORD_POOL_STATISTICS,     "record per-thread autorelease pool statistics for objc_getAutoreleasePoolStatistics()")
+OPTION( FlattenMethodLists,       OBJC_FLATTEN_METHOD_LISTS,       "search one merged method table per class instead of each attached method list")
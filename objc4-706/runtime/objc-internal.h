@@ -91,6 +91,99 @@ OBJC_EXPORT Class _objc_getFreedObjectClass(void)
 OBJC_EXPORT void instrumentObjcMessageSends(BOOL flag)
     OBJC_AVAILABLE(10.0, 2.0, 9.0, 1.0);
 
+// Per-class method cache statistics.
+// Recorded only when environment variable OBJC_RECORD_CACHE_STATISTICS=YES.
+// Average probe length is totalProbes/fills. 
+// Occupancy is occupied/capacity at the time of the snapshot.
+typedef struct {
+    Class cls;
+    uint64_t fills;        // entries added, one per cache miss
+    uint64_t expansions;   // times the cache grew
+    uint64_t erases;       // times the cache was flushed
+    uint64_t totalProbes;  // sum of extra slots scanned to place each fill
+    uint32_t maxProbes;    // longest such scan
+    uint32_t occupied;     // entries in the cache now
+    uint32_t capacity;     // slots in the cache now
+} objc_method_cache_statistics_t;
+
+// Returns a malloc'd array of statistics, one per class whose method cache 
+// has been filled since the process started. Caller must free() it.
+// Returns NULL and sets *outCount to 0 if statistics are not recorded.
+OBJC_EXPORT objc_method_cache_statistics_t *
+objc_copyMethodCacheStatistics(unsigned int *outCount)
+    OBJC_AVAILABLE(10.13, 11.0, 11.0, 4.0);
+
+// Contention counters for one of the runtime's internal spinlocks, 
+// such as a side table stripe or an associated object shard.
+// The counters are not synchronized, so a snapshot is approximate.
+typedef struct {
+    const char *name;       // "SideTable", "SyncList", "AssociationsManager"
+    unsigned int index;     // stripe number, for locks with several stripes
+    uint64_t acquisitions;  // times the lock was taken
+    uint64_t contended;     // acquisitions that found it already held
+    uint64_t spins;         // pause instructions spent waiting for it
+    uint64_t parks;         // waits that gave up spinning and blocked
+} objc_lock_contention_t;
+
+// Returns a malloc'd array of counters, one per runtime spinlock 
+// taken at least once. Caller must free() it.
+// Returns NULL and sets *outCount to 0 if the runtime was built 
+// without lock statistics.
+OBJC_EXPORT objc_lock_contention_t *
+objc_copyLockContention(unsigned int *outCount)
+    OBJC_AVAILABLE(10.13, 11.0, 11.0, 4.0);
+
+// Weak reference table statistics for one side table stripe.
+typedef struct {
+    unsigned int stripe;
+    uint64_t entries;                  // weakly referenced objects
+    uint64_t capacity;                 // slots in the stripe's weak table
+    uint64_t referrers;                // __weak variables registered
+    uint64_t tableBytes;               // bytes used by the weak table
+    uint64_t outOfLineEntries;         // objects with more than 4 referrers
+    uint64_t outOfLineBytes;           // bytes used by their referrer sets
+    double loadFactor;                 // entries / capacity
+    uint64_t maxDisplacement;          // longest probe in the weak table
+    uint64_t maxReferrerDisplacement;  // longest probe in any referrer set
+} objc_weak_table_statistics_t;
+
+// Returns a malloc'd array of statistics, one per side table stripe. 
+// Caller must free() it.
+OBJC_EXPORT objc_weak_table_statistics_t *
+objc_copyWeakTableStatistics(unsigned int *outCount)
+    OBJC_AVAILABLE(10.13, 11.0, 11.0, 4.0);
+
+// Shrinks over-allocated weak tables and referrer sets to fit.
+// Call when idle; it takes each side table lock in turn.
+// Returns the number of bytes freed.
+OBJC_EXPORT size_t
+objc_compactWeakTables(void)
+    OBJC_AVAILABLE(10.13, 11.0, 11.0, 4.0);
+
+// Batched method updates.
+// Each call takes the runtime lock once and updates method caches once,
+// instead of once per change. Use these to install many methods at once.
+typedef struct {
+    Class cls;
+    SEL name;
+    IMP imp;
+    const char *types;
+} objc_method_replacement_t;
+
+// Calls class_replaceMethod(cls, name, imp, types) for each replacement,
+// in order. If outOldImps is not NULL, outOldImps[i] is set to the
+// value class_replaceMethod would have returned for replacements[i].
+OBJC_EXPORT void
+objc_replaceMethods(const objc_method_replacement_t *replacements,
+                    unsigned int count, IMP *outOldImps)
+    OBJC_AVAILABLE(10.13, 11.0, 11.0, 4.0);
+
+// Calls method_exchangeImplementations(methods[2*i], methods[2*i+1])
+// for each i less than pairCount, in order.
+OBJC_EXPORT void
+objc_exchangeMethodImplementations(Method *methods, unsigned int pairCount)
+    OBJC_AVAILABLE(10.13, 11.0, 11.0, 4.0);
+
 // Initializer called by libSystem
 OBJC_EXPORT void _objc_init(void)
 #if __OBJC2__
@@ -514,6 +607,22 @@ OBJC_EXPORT id objc_autorelease(id obj)
     __asm__("_objc_autorelease")
     OBJC_AVAILABLE(10.7, 5.0, 9.0, 1.0);
 
+// Retain, release, or autorelease each of count objects.
+// Faster than calling objc_retain() et al. on each one.
+OBJC_EXPORT void objc_retainArray(id *objects, size_t count)
+    OBJC_AVAILABLE(10.13, 11.0, 11.0, 4.0);
+
+OBJC_EXPORT void objc_releaseArray(id *objects, size_t count)
+    OBJC_AVAILABLE(10.13, 11.0, 11.0, 4.0);
+
+OBJC_EXPORT void objc_autoreleaseArray(id *objects, size_t count)
+    OBJC_AVAILABLE(10.13, 11.0, 11.0, 4.0);
+
+// Make obj immortal: never deallocated, with retain/release/autorelease 
+// doing nothing. Intended for singletons and other shared constants.
+OBJC_EXPORT void objc_setImmortal(id obj)
+    OBJC_AVAILABLE(10.13, 11.0, 11.0, 4.0);
+
 // Prepare a value at +1 for return through a +0 autoreleasing convention.
 OBJC_EXPORT
 id
@@ -599,6 +708,64 @@ void
 _objc_autoreleasePoolPrint(void)
     OBJC_AVAILABLE(10.7, 5.0, 9.0, 1.0);
 
+// A growable array of __weak slots, for containers of many weak 
+// references. Appending and destroying take each side table lock 
+// once per batch instead of once per slot. 
+// A weak array is not thread-safe; callers must synchronize.
+typedef struct objc_weakarray *objc_weakarray_t;
+
+OBJC_EXPORT objc_weakarray_t
+objc_weakarray_create(void)
+    OBJC_AVAILABLE(10.13, 11.0, 11.0, 4.0);
+
+OBJC_EXPORT void
+objc_weakarray_destroy(objc_weakarray_t array)
+    OBJC_AVAILABLE(10.13, 11.0, 11.0, 4.0);
+
+// Appends a weak reference to each of count objects. 
+// Deallocating objects are appended as nil.
+OBJC_EXPORT void
+objc_weakarray_append(objc_weakarray_t array, id *objects, size_t count)
+    OBJC_AVAILABLE(10.13, 11.0, 11.0, 4.0);
+
+// Slots in the array, including slots whose objects were deallocated.
+OBJC_EXPORT size_t
+objc_weakarray_count(objc_weakarray_t array)
+    OBJC_AVAILABLE(10.13, 11.0, 11.0, 4.0);
+
+// Sets *outObjects to a malloc'd array of the live objects, each retained. 
+// Returns their count. Caller must objc_releaseArray() and free() it.
+OBJC_EXPORT size_t
+objc_weakarray_snapshot(objc_weakarray_t array, id **outObjects)
+    OBJC_AVAILABLE(10.13, 11.0, 11.0, 4.0);
+
+// Removes up to about maxSlots nil slots, resuming where the last call 
+// stopped. The order of the remaining slots is not preserved.
+// Returns the number of slots removed.
+OBJC_EXPORT size_t
+objc_weakarray_compact(objc_weakarray_t array, size_t maxSlots)
+    OBJC_AVAILABLE(10.13, 11.0, 11.0, 4.0);
+
+// Autorelease pool statistics for the calling thread.
+// depth, pages and entries describe the pools now in place.
+// The rest are recorded only when environment variable 
+// OBJC_RECORD_POOL_STATISTICS=YES, and are zero otherwise. 
+// Sizes are in pool slots, measured when a pool is popped.
+typedef struct {
+    uint32_t depth;        // pools pushed and not yet popped
+    uint32_t pages;        // pool pages in use
+    uint64_t entries;      // releases pending
+    uint64_t hiwat;        // most slots in use, over all pools
+    uint64_t largestPool;  // most slots used by a single pool
+    uint64_t pushes;       // pools pushed
+    uint64_t pops;         // pools popped explicitly
+} objc_autorelease_pool_statistics_t;
+
+OBJC_EXPORT
+void
+objc_getAutoreleasePoolStatistics(objc_autorelease_pool_statistics_t *outStats)
+    OBJC_AVAILABLE(10.13, 11.0, 11.0, 4.0);
+
 OBJC_EXPORT BOOL objc_should_deallocate(id object)
     OBJC_AVAILABLE(10.7, 5.0, 9.0, 1.0);
 
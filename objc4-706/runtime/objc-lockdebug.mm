@@ -203,7 +203,7 @@ lockdebug_mutex_lock(mutex_t *lock)
 // try-lock when already locked is OK (will fail)
 // try-lock failure does nothing.
 void 
-lockdebug_mutex_try_lock_success(mutex_t *lock)
+lockdebug_mutex_try_lock(mutex_t *lock)
 {
     _objc_lock_list *locks = getLocks(YES);
     setLock(locks, lock, MUTEX);
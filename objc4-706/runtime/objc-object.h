@@ -147,6 +147,77 @@ objc_object::isExtTaggedPointer()
 
 #if SUPPORT_NONPOINTER_ISA
 
+#if SUPPORT_BIASED_REFCOUNTS
+
+/***********************************************************************
+* Biased retain counts (OBJC_BIASED_REFCOUNTS)
+* An object allocated while the option is set is biased to the 
+* allocating thread, if that thread's table has room for it. 
+* The owner counts its retains and releases of the object in its 
+* biased_rc_table_t, without atomic operations. The object's own 
+* retain count keeps one retain on behalf of that table entry.
+* Other threads retain and release the object as usual. If another 
+* thread's release would drop that last retain, it is recorded in the 
+* side table as a debt for the owner to merge instead.
+* The owner merges debts on its next release of any object, when it 
+* allocates, when it pops its outermost autorelease pool, and when it 
+* exits. It gives up the bias when its count falls to zero, when 
+* debts use up its count, and when it exits. See NSObject.mm.
+**********************************************************************/
+struct biased_rc_entry_t {
+    objc_object *obj;
+    uintptr_t count;
+};
+
+struct biased_rc_table_t {
+    enum { EntryCount = 256 };
+    biased_rc_entry_t entries[EntryCount];
+
+    // Set by other threads when they record a debt for this thread.
+    volatile bool hasDebts;
+
+    biased_rc_entry_t& entryFor(const objc_object *obj) {
+        uintptr_t addr = (uintptr_t)obj;
+        return entries[(addr >> 4) & (EntryCount-1)];
+    }
+
+    // Returns the entry for obj, or nil if obj isn't biased to this table.
+    biased_rc_entry_t *find(const objc_object *obj) {
+        biased_rc_entry_t& entry = entryFor(obj);
+        return (entry.obj == obj) ? &entry : nil;
+    }
+};
+
+// Applies the debts other threads recorded against table's entries.
+extern void biased_merge(biased_rc_table_t *table);
+
+static ALWAYS_INLINE biased_rc_table_t *
+biasedTable()
+{
+    return (biased_rc_table_t *)tls_get_direct(BIASED_RC_KEY);
+}
+
+// Returns this thread's entry for obj, or nil if obj isn't biased to it.
+static ALWAYS_INLINE biased_rc_entry_t *
+biasedEntry(const objc_object *obj)
+{
+    biased_rc_table_t *table = biasedTable();
+    if (!table) return nil;
+    return table->find(obj);
+}
+
+// Frees objects whose last reference another thread released.
+static inline void
+biasedMergeDebts()
+{
+    biased_rc_table_t *table = biasedTable();
+    if (table  &&  table->hasDebts) biased_merge(table);
+}
+
+// SUPPORT_BIASED_REFCOUNTS
+#endif
+
+
 inline Class 
 objc_object::ISA() 
 {
@@ -199,6 +270,10 @@ objc_object::initInstanceIsa(Class cls, bool hasCxxDtor)
     assert(hasCxxDtor == cls->hasCxxDtor());
 
     initIsa(cls, true, hasCxxDtor);
+
+#if SUPPORT_BIASED_REFCOUNTS
+    if (slowpath(BiasedRefcounts)) biasedAdopt();
+#endif
 }
 
 inline void 
@@ -303,7 +378,8 @@ objc_object::changeIsa(Class newCls)
         // oldisa.has_cxx_dtor: nothing to do
         sidetable_moveExtraRC_nolock(oldisa.extra_rc, 
                                      oldisa.deallocating, 
-                                     oldisa.weakly_referenced);
+                                     oldisa.weakly_referenced, 
+                                     oldisa.isImmortal());
     }
 
     if (sideTableLocked) sidetable_unlock();
@@ -376,6 +452,37 @@ objc_object::setWeaklyReferenced_nolock()
 }
 
 
+inline bool
+objc_object::isImmortal()
+{
+    assert(!isTaggedPointer());
+    if (fastpath(isa.nonpointer)) return isa.isImmortal();
+    return sidetable_isImmortal();
+}
+
+
+inline void
+objc_object::setImmortal()
+{
+    assert(!isTaggedPointer());
+
+ retry:
+    isa_t oldisa = LoadExclusive(&isa.bits);
+    isa_t newisa = oldisa;
+    if (slowpath(!newisa.nonpointer)) {
+        ClearExclusive(&isa.bits);
+        sidetable_setImmortal();
+        return;
+    }
+    if (newisa.isImmortal()) {
+        ClearExclusive(&isa.bits);
+        return;
+    }
+    newisa.extra_rc = RC_IMMORTAL;
+    if (!StoreExclusive(&isa.bits, oldisa.bits, newisa.bits)) goto retry;
+}
+
+
 inline bool
 objc_object::hasCxxDtor()
 {
@@ -466,11 +573,62 @@ objc_object::rootTryRetain()
     return rootRetain(true, false) ? true : false;
 }
 
+// tryRetain for objc_loadWeakRetained()'s lock-free path. 
+// Never takes a lock. Returns false if the caller must use the 
+// locked path instead: raw isa or inline retain count overflow.
+// Otherwise sets retained to whether the object was retained.
+// The caller checks for RR overrides.
+ALWAYS_INLINE bool 
+objc_object::rootTryRetain_lockFree(bool& retained)
+{
+    assert(!isTaggedPointer());
+
+    isa_t oldisa;
+    isa_t newisa;
+
+    do {
+        oldisa = LoadExclusive(&isa.bits);
+        newisa = oldisa;
+        if (slowpath(!newisa.nonpointer)) {
+            ClearExclusive(&isa.bits);
+            return false;
+        }
+        if (slowpath(newisa.isImmortal())) {
+            ClearExclusive(&isa.bits);
+            retained = true;
+            return true;
+        }
+        if (slowpath(newisa.deallocating)) {
+            ClearExclusive(&isa.bits);
+            retained = false;
+            return true;
+        }
+        newisa.bits += RC_ONE;  // extra_rc++, below RC_IMMORTAL so no carry
+        if (slowpath(newisa.isImmortal())) {
+            ClearExclusive(&isa.bits);
+            return false;
+        }
+    } while (slowpath(!StoreExclusive(&isa.bits, oldisa.bits, newisa.bits)));
+
+    retained = true;
+    return true;
+}
+
+
 ALWAYS_INLINE id 
 objc_object::rootRetain(bool tryRetain, bool handleOverflow)
 {
     if (isTaggedPointer()) return (id)this;
 
+#if SUPPORT_BIASED_REFCOUNTS
+    if (slowpath(BiasedRefcounts)  &&  !tryRetain  &&  !handleOverflow) {
+        if (biased_rc_entry_t *entry = biasedEntry(this)) {
+            entry->count++;
+            return (id)this;
+        }
+    }
+#endif
+
     bool sideTableLocked = false;
     bool transcribeToSideTable = false;
 
@@ -487,27 +645,33 @@ objc_object::rootRetain(bool tryRetain, bool handleOverflow)
             if (tryRetain) return sidetable_tryRetain() ? (id)this : nil;
             else return sidetable_retain();
         }
+        if (slowpath(newisa.isImmortal())) {
+            ClearExclusive(&isa.bits);
+            if (!tryRetain && sideTableLocked) sidetable_unlock();
+            return (id)this;
+        }
         // don't check newisa.fast_rr; we already called any RR overrides
         if (slowpath(tryRetain && newisa.deallocating)) {
             ClearExclusive(&isa.bits);
             if (!tryRetain && sideTableLocked) sidetable_unlock();
             return nil;
         }
-        uintptr_t carry;
-        newisa.bits = addc(newisa.bits, RC_ONE, 0, &carry);  // extra_rc++
+        newisa.bits += RC_ONE;  // extra_rc++, below RC_IMMORTAL so no carry
 
-        if (slowpath(carry)) {
-            // newisa.extra_rc++ overflowed
+        if (slowpath(newisa.isImmortal())) {
+            // newisa.extra_rc++ overflowed into RC_IMMORTAL
             if (!handleOverflow) {
                 ClearExclusive(&isa.bits);
                 return rootRetain_overflow(tryRetain);
             }
             // Leave half of the retain counts inline and 
             // prepare to copy the other half to the side table.
+            // Exactly RC_HALF goes there, so the side table count 
+            // stays a multiple of what releases borrow back.
             if (!tryRetain && !sideTableLocked) sidetable_lock();
             sideTableLocked = true;
             transcribeToSideTable = true;
-            newisa.extra_rc = RC_HALF;
+            newisa.extra_rc = RC_HALF - 1;
             newisa.has_sidetable_rc = true;
         }
     } while (slowpath(!StoreExclusive(&isa.bits, oldisa.bits, newisa.bits)));
@@ -564,6 +728,25 @@ objc_object::rootRelease(bool performDealloc, bool handleUnderflow)
 {
     if (isTaggedPointer()) return false;
 
+#if SUPPORT_BIASED_REFCOUNTS
+    if (slowpath(BiasedRefcounts)  &&  !handleUnderflow) {
+        if (biased_rc_table_t *table = biasedTable()) {
+            // Free objects whose last reference another thread released 
+            // now rather than when this thread next allocates. 
+            // The caller's reference keeps this object alive meanwhile.
+            if (slowpath(table->hasDebts)) biased_merge(table);
+
+            if (biased_rc_entry_t *entry = table->find(this)) {
+                if (entry->count > 1) {
+                    entry->count--;
+                    return false;
+                }
+                return biasedRelease_last(entry, performDealloc);
+            }
+        }
+    }
+#endif
+
     bool sideTableLocked = false;
 
     isa_t oldisa;
@@ -578,6 +761,11 @@ objc_object::rootRelease(bool performDealloc, bool handleUnderflow)
             if (sideTableLocked) sidetable_unlock();
             return sidetable_release(performDealloc);
         }
+        if (slowpath(newisa.isImmortal())) {
+            ClearExclusive(&isa.bits);
+            if (sideTableLocked) sidetable_unlock();
+            return false;
+        }
         // don't check newisa.fast_rr; we already called any RR overrides
         uintptr_t carry;
         newisa.bits = subc(newisa.bits, RC_ONE, 0, &carry);  // extra_rc--
@@ -617,6 +805,16 @@ objc_object::rootRelease(bool performDealloc, bool handleUnderflow)
         // Try to remove some retain counts from the side table.        
         size_t borrowed = sidetable_subExtraRC_nolock(RC_HALF);
 
+        if (slowpath(borrowed == SIDE_TABLE_RC_BUSY)) {
+            // Lock-free borrows may still put counts back. 
+            // Let them finish without the lock, then start over.
+            ClearExclusive(&isa.bits);
+            sidetable_unlock();
+            sideTableLocked = false;
+            spin_pause();
+            goto retry;
+        }
+
         // To avoid races, has_sidetable_rc must remain set 
         // even if the side table count is now zero.
 
@@ -637,7 +835,7 @@ objc_object::rootRelease(bool performDealloc, bool handleUnderflow)
                     uintptr_t overflow;
                     newisa2.bits = 
                         addc(newisa2.bits, RC_ONE * (borrowed-1), 0, &overflow);
-                    if (!overflow) {
+                    if (!overflow  &&  !newisa2.isImmortal()) {
                         stored = StoreReleaseExclusive(&isa.bits, oldisa2.bits, 
                                                        newisa2.bits);
                     }
@@ -665,6 +863,17 @@ objc_object::rootRelease(bool performDealloc, bool handleUnderflow)
 
     // Really deallocate.
 
+#if SUPPORT_BIASED_REFCOUNTS
+    if (slowpath(BiasedRefcounts  &&  sideTableLocked  &&  
+                 sidetable_deferBiasedRelease_nolock()))
+    {
+        // The owning thread's biased count still holds retains.
+        ClearExclusive(&isa.bits);
+        sidetable_unlock();
+        return false;
+    }
+#endif
+
     if (slowpath(newisa.deallocating)) {
         ClearExclusive(&isa.bits);
         if (sideTableLocked) sidetable_unlock();
@@ -700,6 +909,7 @@ inline id
 objc_object::rootAutorelease()
 {
     if (isTaggedPointer()) return (id)this;
+    if (slowpath(isImmortal())) return (id)this;
     if (prepareOptimizedReturn(ReturnAtPlus1)) return (id)this;
 
     return rootAutorelease2();
@@ -718,6 +928,11 @@ objc_object::rootRetainCount()
         uintptr_t rc = 1 + bits.extra_rc;
         if (bits.has_sidetable_rc) {
             rc += sidetable_getExtraRC_nolock();
+#if SUPPORT_BIASED_REFCOUNTS
+            if (slowpath(BiasedRefcounts)) {
+                rc += sidetable_getBiasedRC_nolock();
+            }
+#endif
         }
         sidetable_unlock();
         return rc;
@@ -840,6 +1055,23 @@ objc_object::setWeaklyReferenced_nolock()
 }
 
 
+inline bool
+objc_object::isImmortal()
+{
+    assert(!isTaggedPointer());
+    return sidetable_isImmortal();
+}
+
+
+inline void
+objc_object::setImmortal()
+{
+    assert(!isTaggedPointer());
+
+    sidetable_setImmortal();
+}
+
+
 inline bool
 objc_object::hasCxxDtor()
 {
@@ -964,6 +1196,13 @@ objc_object::rootTryRetain()
 }
 
 
+inline bool 
+objc_object::rootTryRetain_lockFree(bool& retained)
+{
+    return false;
+}
+
+
 inline uintptr_t 
 objc_object::rootRetainCount()
 {
@@ -375,6 +375,15 @@ extern void _objc_fatal_with_reason(uint64_t reason, uint64_t flags,
 # if SUPPORT_QOS_HACK
 #   define QOS_KEY               ((tls_key_t)__PTK_FRAMEWORK_OBJC_KEY5)
 # endif
+# if SUPPORT_CACHE_READER_EPOCHS
+    // objc-msg-x86_64.s reads this slot directly. Keep CACHE_READER_TSD in sync.
+#   define CACHE_READER_KEY      ((tls_key_t)__PTK_FRAMEWORK_OBJC_KEY6)
+# endif
+# if SUPPORT_BIASED_REFCOUNTS
+#   define BIASED_RC_KEY         ((tls_key_t)__PTK_FRAMEWORK_OBJC_KEY7)
+# endif
+#   define AUTORELEASE_POOL_CACHE_KEY ((tls_key_t)__PTK_FRAMEWORK_OBJC_KEY8)
+#   define AUTORELEASE_POOL_STATS_KEY ((tls_key_t)__PTK_FRAMEWORK_OBJC_KEY9)
 #else
 #   define SUPPORT_DIRECT_THREAD_KEYS 0
 #endif
@@ -686,6 +695,14 @@ static bool is_valid_direct_key(tls_key_t k) {
 #   if SUPPORT_QOS_HACK
             || k == QOS_KEY
 #   endif
+#   if SUPPORT_CACHE_READER_EPOCHS
+            || k == CACHE_READER_KEY
+#   endif
+#   if SUPPORT_BIASED_REFCOUNTS
+            || k == BIASED_RC_KEY
+#   endif
+            || k == AUTORELEASE_POOL_CACHE_KEY
+            || k == AUTORELEASE_POOL_STATS_KEY
                );
 }
 #endif
@@ -785,11 +802,12 @@ static inline pthread_priority_t pthread_self_priority_direct()
 
 
 template <bool Debug> class mutex_tt;
+template <bool Debug> class spinlock_tt;
 template <bool Debug> class monitor_tt;
 template <bool Debug> class rwlock_tt;
 template <bool Debug> class recursive_mutex_tt;
 
-using spinlock_t = mutex_tt<DEBUG>;
+using spinlock_t = spinlock_tt<DEBUG>;
 using mutex_t = mutex_tt<DEBUG>;
 using monitor_t = monitor_tt<DEBUG>;
 using rwlock_t = rwlock_tt<DEBUG>;
@@ -810,6 +828,14 @@ class mutex_tt : nocopy_t {
             (&mLock, OS_UNFAIR_LOCK_DATA_SYNCHRONIZATION);
     }
 
+    bool tryLock() {
+        if (os_unfair_lock_trylock(&mLock)) {
+            lockdebug_mutex_try_lock(this);
+            return true;
+        }
+        return false;
+    }
+
     void unlock() {
         lockdebug_mutex_unlock(this);
 
@@ -844,6 +870,135 @@ class mutex_tt : nocopy_t {
 };
 
 
+// Hint to the CPU that we are busy-waiting.
+static ALWAYS_INLINE void spin_pause()
+{
+#if defined(__x86_64__)  ||  defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__arm__)  ||  defined(__arm64__)
+    __asm__ __volatile__ ("yield");
+#endif
+}
+
+
+#if SUPPORT_LOCK_CONTENTION_STATS
+// Contention counters for one spinlock_t. 
+// Updated only by the lock's owner, so reads from other threads 
+// are approximate.
+struct lock_contention_t {
+    uint64_t acquisitions;  // all lock() calls
+    uint64_t contended;     // lock() calls that found the lock held
+    uint64_t spins;         // spin_pause() calls while contended
+    uint64_t parks;         // contended lock() calls that gave up spinning
+};
+#endif
+
+
+// spinlock_t guards short critical sections like the side tables'. 
+// A contended lock() spins with exponential backoff for a while 
+// in case the owner is about to leave, and then parks in the 
+// kernel (os_unfair_lock) until the lock is handed over.
+template <bool Debug>
+class spinlock_tt : nocopy_t {
+    mutex_tt<Debug> mLock;
+#if SUPPORT_LOCK_CONTENTION_STATS
+    lock_contention_t mStats;
+#endif
+
+    // Longest backoff before parking, in spin_pause() calls. 
+    // That is about 2*SpinBackoffLimit pauses in all.
+    enum { SpinBackoffLimit = 64 };
+
+    NEVER_INLINE void lockContended() {
+        bool parked = false;
+        uint64_t spins = 0;
+        for (unsigned backoff = 1; ; backoff *= 2) {
+            if (backoff > SpinBackoffLimit) {
+                mLock.lock();
+                parked = true;
+                break;
+            }
+            for (unsigned i = 0; i < backoff; i++) spin_pause();
+            spins += backoff;
+            if (mLock.tryLock()) break;
+        }
+
+#if SUPPORT_LOCK_CONTENTION_STATS
+        mStats.acquisitions++;
+        mStats.contended++;
+        mStats.spins += spins;
+        if (parked) mStats.parks++;
+#else
+        (void)parked;
+        (void)spins;
+#endif
+    }
+
+ public:
+#if SUPPORT_LOCK_CONTENTION_STATS
+    spinlock_tt() : mStats() { }
+#else
+    spinlock_tt() { }
+#endif
+
+    void lock() {
+        if (fastpath(mLock.tryLock())) {
+#if SUPPORT_LOCK_CONTENTION_STATS
+            mStats.acquisitions++;
+#endif
+        } else {
+            lockContended();
+        }
+    }
+
+    bool tryLock() {
+        if (mLock.tryLock()) {
+#if SUPPORT_LOCK_CONTENTION_STATS
+            mStats.acquisitions++;
+#endif
+            return true;
+        }
+        return false;
+    }
+
+    void unlock() {
+        mLock.unlock();
+    }
+
+    void assertLocked() {
+        mLock.assertLocked();
+    }
+
+    void assertUnlocked() {
+        mLock.assertUnlocked();
+    }
+
+#if SUPPORT_LOCK_CONTENTION_STATS
+    const lock_contention_t& contention() const {
+        return mStats;
+    }
+#endif
+
+
+    // Address-ordered lock discipline for a pair of locks.
+
+    static void lockTwo(spinlock_tt *lock1, spinlock_tt *lock2) {
+        if (lock1 > lock2) {
+            lock1->lock();
+            lock2->lock();
+        } else {
+            lock2->lock();
+            if (lock2 != lock1) lock1->lock(); 
+        }
+    }
+
+    static void unlockTwo(spinlock_tt *lock1, spinlock_tt *lock2) {
+        lock1->unlock();
+        if (lock2 != lock1) lock2->unlock();
+    }
+};
+
+
 template <bool Debug>
 class recursive_mutex_tt : nocopy_t {
     pthread_mutex_t mLock;
@@ -620,6 +620,7 @@ void _objc_init(void)
     tls_init();
     static_init();
     lock_init();
+    cache_init();
     exception_init();
 
     _dyld_objc_notify_register(&map_2_images, load_images, unmap_image);
@@ -80,6 +80,8 @@ union isa_t
     // shiftcls must occupy the same bits that a real class pointer would
     // bits + RC_ONE is equivalent to extra_rc + 1
     // RC_HALF is the high bit of extra_rc (i.e. half of its range)
+    // RC_IMMORTAL, the largest extra_rc, marks immortal objects
+    // (see objc_setImmortal()); other counts overflow before reaching it
 
     // future expansion:
     // uintptr_t fast_rr : 1;     // no r/r overrides
@@ -102,6 +104,7 @@ union isa_t
         uintptr_t extra_rc          : 19;
 #       define RC_ONE   (1ULL<<45)
 #       define RC_HALF  (1ULL<<18)
+#       define RC_IMMORTAL ((1ULL<<19)-1)
     };
 
 # elif __x86_64__
@@ -120,6 +123,7 @@ union isa_t
         uintptr_t extra_rc          : 8;
 #       define RC_ONE   (1ULL<<56)
 #       define RC_HALF  (1ULL<<7)
+#       define RC_IMMORTAL ((1ULL<<8)-1)
     };
 
 # else
@@ -153,6 +157,7 @@ union isa_t
         uintptr_t extra_rc          : 7;
 #       define RC_ONE   (1ULL<<25)
 #       define RC_HALF  (1ULL<<6)
+#       define RC_IMMORTAL ((1ULL<<7)-1)
     };
 
 # else
@@ -162,9 +167,18 @@ union isa_t
 // SUPPORT_INDEXED_ISA
 #endif
 
+#if SUPPORT_NONPOINTER_ISA
+    bool isImmortal() const {
+        return nonpointer  &&  extra_rc == RC_IMMORTAL;
+    }
+#endif
 };
 
 
+// sidetable_subExtraRC_nolock() result when it would have to wait for 
+// lock-free borrows. The caller unlocks the side table and retries.
+#define SIDE_TABLE_RC_BUSY (~(size_t)0)
+
 struct objc_object {
 private:
     isa_t isa;
@@ -206,6 +220,11 @@ public:
     bool isWeaklyReferenced();
     void setWeaklyReferenced_nolock();
 
+    // object is never deallocated, and retain/release do nothing?
+    // isImmortal() may miss immortal objects only the side table records.
+    bool isImmortal();
+    void setImmortal();
+
     // object may have -.cxx_destruct implementation?
     bool hasCxxDtor();
 
@@ -219,9 +238,20 @@ public:
     bool rootRelease();
     id rootAutorelease();
     bool rootTryRetain();
+    bool rootTryRetain_lockFree(bool& retained);
     bool rootReleaseShouldDealloc();
     uintptr_t rootRetainCount();
 
+    // Batched retain/release for objc_retainArray() and objc_releaseArray().
+    // The _inline versions return false if the side table is needed.
+    // The _nolock versions need the side table locked by the caller.
+    // batchRelease_nolock() returns true if the object should be 
+    // deallocated, which the caller does after unlocking.
+    bool batchRetain_inline();
+    bool batchRelease_inline();
+    void batchRetain_nolock();
+    bool batchRelease_nolock();
+
     // Implementation of dealloc methods
     bool rootIsDeallocating();
     void clearDeallocating();
@@ -243,14 +273,25 @@ private:
 
     void clearDeallocating_slow();
 
+#if SUPPORT_BIASED_REFCOUNTS
+    // Biased retain counts (OBJC_BIASED_REFCOUNTS)
+    void biasedAdopt();
+    bool biasedRelease_last(struct biased_rc_entry_t *entry, 
+                            bool performDealloc);
+    bool sidetable_deferBiasedRelease_nolock();
+    intptr_t sidetable_getBiasedRC_nolock();
+#endif
+
     // Side table retain count overflow for nonpointer isa
     void sidetable_lock();
     void sidetable_unlock();
 
-    void sidetable_moveExtraRC_nolock(size_t extra_rc, bool isDeallocating, bool weaklyReferenced);
+    void sidetable_moveExtraRC_nolock(size_t extra_rc, bool isDeallocating, bool weaklyReferenced, bool immortal);
     bool sidetable_addExtraRC_nolock(size_t delta_rc);
     size_t sidetable_subExtraRC_nolock(size_t delta_rc);
     size_t sidetable_getExtraRC_nolock();
+    bool sidetable_tryAddExtraRC();
+    bool sidetable_tryBorrowExtraRC();
 #endif
 
     // Side-table-only retain count
@@ -260,6 +301,9 @@ private:
     bool sidetable_isWeaklyReferenced();
     void sidetable_setWeaklyReferenced_nolock();
 
+    bool sidetable_isImmortal();
+    void sidetable_setImmortal();
+
     id sidetable_retain();
     id sidetable_retain_slow(SideTable& table);
 
@@ -594,6 +638,15 @@ extern char *copyPropertyAttributeValue(const char *attrs, const char *name);
 
 /* locking */
 extern void lock_init(void);
+
+// Calls visitor on each of a subsystem's spinlocks. 
+// Used by objc_copyLockContention().
+typedef void (*spinlock_visitor_t)(const char *name, unsigned int index, 
+                                   spinlock_t& lock, void *context);
+extern void sidetable_visitLocks(spinlock_visitor_t visitor, void *context);
+extern void sync_visitLocks(spinlock_visitor_t visitor, void *context);
+extern void associations_visitLocks(spinlock_visitor_t visitor, void *context);
+extern void cache_init(void);
 extern rwlock_t selLock;
 extern mutex_t cacheUpdateLock;
 extern recursive_mutex_t loadMethodLock;
@@ -864,26 +917,43 @@ class TimeLogger {
 // for cache-friendly lock striping. 
 // For example, this may be used as StripedMap<spinlock_t>
 // or as StripedMap<SomeStruct> where SomeStruct stores a spin lock.
-template<typename T>
-class StripedMap {
-
-    enum { CacheLineSize = 64 };
-
+// StripeCountLog2 sets the size of the array. A zero-filled map uses 
+// every stripe; setStripeCount() may choose fewer before first use.
 #if TARGET_OS_EMBEDDED
-    enum { StripeCount = 8 };
+#   define STRIPED_MAP_DEFAULT_COUNT_LOG2 3
 #else
-    enum { StripeCount = 64 };
+#   define STRIPED_MAP_DEFAULT_COUNT_LOG2 6
 #endif
 
+template<typename T, 
+         unsigned StripeCountLog2 = STRIPED_MAP_DEFAULT_COUNT_LOG2>
+class StripedMap {
+
+    enum { CacheLineSize = 64 };
+    enum { StripeCount = 1 << StripeCountLog2 };
+
     struct PaddedT {
         T value alignas(CacheLineSize);
     };
 
     PaddedT array[StripeCount];
 
-    static unsigned int indexForPointer(const void *p) {
-        uintptr_t addr = reinterpret_cast<uintptr_t>(p);
-        return ((addr >> 4) ^ (addr >> 9)) % StripeCount;
+    // Stripes left unused: only the first StripeCount >> unusedLog2 are hit.
+    unsigned int unusedLog2;
+
+    unsigned int indexForPointer(const void *p) const {
+        // Fibonacci hashing: multiply by 2^N/phi and keep the top bits, 
+        // which depend on every bit of the address. Allocations are 
+        // 16-byte aligned so the low bits carry nothing.
+#if __LP64__
+        uintptr_t hash = (reinterpret_cast<uintptr_t>(p) >> 4) * 
+            0x9e3779b97f4a7c15ULL;
+#else
+        uintptr_t hash = (reinterpret_cast<uintptr_t>(p) >> 4) * 
+            0x9e3779b9UL;
+#endif
+        return (unsigned int)
+            (hash >> (sizeof(uintptr_t)*8 - StripeCountLog2 + unusedLog2));
     }
 
  public:
@@ -891,7 +961,26 @@ class StripedMap {
         return array[indexForPointer(p)].value; 
     }
     const T& operator[] (const void *p) const { 
-        return const_cast<StripedMap<T>>(this)[p]; 
+        return const_cast<StripedMap<T, StripeCountLog2>>(this)[p]; 
+    }
+
+    // Uses the first count stripes, rounded down to a power of two 
+    // and clamped to [2, StripeCount]. 
+    // Call before the map is used.
+    void setStripeCount(unsigned int count) {
+        unsigned int log2 = 1;
+        while (log2 < StripeCountLog2  &&  (2U << log2) <= count) log2++;
+        unusedLog2 = StripeCountLog2 - log2;
+    }
+
+    unsigned int stripeCount() const {
+        return StripeCount >> unusedLog2;
+    }
+
+    // For walking every stripe, e.g. to collect lock statistics.
+    T& stripeAt(unsigned int i) {
+        assert(i < StripeCount);
+        return array[i].value;
     }
 
 #if DEBUG
@@ -186,26 +186,49 @@ namespace objc_references_support {
 
 using namespace objc_references_support;
 
-// class AssociationsManager manages a lock / hash table singleton pair.
-// Allocating an instance acquires the lock, and calling its assocations() method
-// lazily allocates it.
+// Associations are sharded by object address. Each shard is a lock and 
+// a lazily allocated hash table, so threads working on unrelated objects 
+// do not serialize on one lock.
+
+struct AssociationsShard {
+    spinlock_t lock;
+    AssociationsHashMap *map;   // associative references:  object pointer -> PtrPtrHashMap.
+
+    AssociationsShard() : map(NULL) { }
+};
+
+static StripedMap<AssociationsShard> AssociationsShards;
+
+// class AssociationsManager manages the shard for one object.
+// Allocating an instance acquires the shard's lock, and calling its 
+// assocations() method lazily allocates the shard's table.
 
 class AssociationsManager {
-    static spinlock_t _lock;
-    static AssociationsHashMap *_map;               // associative references:  object pointer -> PtrPtrHashMap.
+    AssociationsShard &_shard;
 public:
-    AssociationsManager()   { _lock.lock(); }
-    ~AssociationsManager()  { _lock.unlock(); }
+    AssociationsManager(id object) : _shard(AssociationsShards[object]) { 
+        _shard.lock.lock(); 
+    }
+    ~AssociationsManager()  { _shard.lock.unlock(); }
     
     AssociationsHashMap &associations() {
-        if (_map == NULL)
-            _map = new AssociationsHashMap();
-        return *_map;
+        if (_shard.map == NULL)
+            _shard.map = new AssociationsHashMap();
+        return *_shard.map;
+    }
+
+    static void visitLocks(spinlock_visitor_t visitor, void *context) {
+        for (unsigned int i = 0; i < AssociationsShards.stripeCount(); i++) {
+            visitor("AssociationsManager", i, 
+                    AssociationsShards.stripeAt(i).lock, context);
+        }
     }
 };
 
-spinlock_t AssociationsManager::_lock;
-AssociationsHashMap *AssociationsManager::_map = NULL;
+void associations_visitLocks(spinlock_visitor_t visitor, void *context)
+{
+    AssociationsManager::visitLocks(visitor, context);
+}
 
 // expanded policy bits.
 
@@ -222,7 +245,7 @@ id _object_get_associative_reference(id object, void *key) {
     id value = nil;
     uintptr_t policy = OBJC_ASSOCIATION_ASSIGN;
     {
-        AssociationsManager manager;
+        AssociationsManager manager(object);
         AssociationsHashMap &associations(manager.associations());
         disguised_ptr_t disguised_object = DISGUISE(object);
         AssociationsHashMap::iterator i = associations.find(disguised_object);
@@ -270,7 +293,7 @@ void _object_set_associative_reference(id object, void *key, id value, uintptr_t
     ObjcAssociation old_association(0, nil);
     id new_value = value ? acquireValue(value, policy) : nil;
     {
-        AssociationsManager manager;
+        AssociationsManager manager(object);
         AssociationsHashMap &associations(manager.associations());
         disguised_ptr_t disguised_object = DISGUISE(object);
         if (new_value) {
@@ -313,7 +336,7 @@ void _object_set_associative_reference(id object, void *key, id value, uintptr_t
 void _object_remove_assocations(id object) {
     vector< ObjcAssociation,ObjcAllocator<ObjcAssociation> > elements;
     {
-        AssociationsManager manager;
+        AssociationsManager manager(object);
         AssociationsHashMap &associations(manager.associations());
         if (associations.size() == 0) return;
         disguised_ptr_t disguised_object = DISGUISE(object);
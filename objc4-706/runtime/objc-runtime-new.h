@@ -45,6 +45,11 @@ public:
     inline void setKey(cache_key_t newKey) { _key = newKey; }
     inline void setImp(IMP newImp) { _imp = newImp; }
 
+    // Atomically change key oldKey to newKey. Used by lock-free fills.
+    inline bool claimKey(cache_key_t oldKey, cache_key_t newKey) {
+        return __sync_bool_compare_and_swap(&_key, oldKey, newKey);
+    }
+
     void set(cache_key_t newKey, IMP newImp);
 };
 
@@ -59,7 +64,8 @@ public:
     mask_t mask();
     mask_t occupied();
     void incrementOccupied();
-    void setBucketsAndMask(struct bucket_t *newBuckets, mask_t newMask);
+    void setBucketsAndMask(struct bucket_t *newBuckets, mask_t newMask, 
+                           mask_t newOccupied = 0);
     void initializeToEmpty();
 
     mask_t capacity();
@@ -247,10 +253,22 @@ struct property_t {
 };
 
 // Two bits of entsize are used for fixup markers.
-struct method_list_t : entsize_list_tt<method_t, method_list_t, 0x3> {
+// The top bit marks big lists stored in Eytzinger order instead of 
+// sorted order. See fixupMethodList().
+#define METHOD_LIST_FIXUP_MASK 0x3
+#define METHOD_LIST_EYTZINGER (1U<<31)
+struct method_list_t : entsize_list_tt<method_t, method_list_t, 
+                                       METHOD_LIST_FIXUP_MASK | 
+                                       METHOD_LIST_EYTZINGER> {
     bool isFixedUp() const;
     void setFixedUp();
 
+    bool isEytzinger() const { return flags() & METHOD_LIST_EYTZINGER; }
+
+    bool containsMethod(const method_t *meth) const {
+        return (meth >= &*begin()  &&  meth < &*end());
+    }
+
     uint32_t indexOfMethod(const method_t *meth) const {
         uint32_t i = 
             (uint32_t)(((uintptr_t)meth - (uintptr_t)this) / entsize());
@@ -818,6 +836,14 @@ struct class_rw_t {
     uint32_t index;
 #endif
 
+    // All method lists merged, for OBJC_FLATTEN_METHOD_LISTS. May be nil.
+    // Built on demand. Discarded whenever method lists are attached.
+    struct method_table_t *methodTable;
+
+    // class_getInstanceMethod() results. May be nil.
+    // Discarded by flushCaches().
+    struct method_lookup_cache_t *methodLookupCache;
+
     void setFlags(uint32_t set) 
     {
         OSAtomicOr32Barrier(set, &flags);
@@ -32,6 +32,7 @@
 #include "objc-runtime-new.h"
 #include "objc-file.h"
 #include "objc-cache.h"
+#include "llvm-DenseMap.h"
 #include <Block.h>
 #include <objc/message.h>
 #include <mach/shared_region.h>
@@ -52,6 +53,9 @@ static bool methodListImplementsRR(const method_list_t *mlist);
 static bool methodListImplementsAWZ(const method_list_t *mlist);
 static void updateCustomRR_AWZ(Class cls, method_t *meth);
 static method_t *search_method_list(const method_list_t *mlist, SEL sel);
+static void rememberMethodListOwner(Class cls, method_list_t **mlists, int count);
+static void discardMethodTable(Class cls);
+static void discardMethodLookupCache(Class cls);
 static void flushCaches(Class cls);
 #if SUPPORT_FIXUP
 static void fixupMessageRef(message_ref_t *msg);
@@ -224,7 +228,7 @@ disableSharedCacheOptimizations(void)
 }
 
 bool method_list_t::isFixedUp() const {
-    return flags() == fixed_up_method_list;
+    return (flags() & METHOD_LIST_FIXUP_MASK) == fixed_up_method_list;
 }
 
 void method_list_t::setFixedUp() {
@@ -538,6 +542,48 @@ static bool isBundleClass(Class cls)
 }
 
 
+/***********************************************************************
+* Eytzinger method lists
+* A big method list fixed up by the runtime is stored in Eytzinger 
+* order rather than sorted order: with methods numbered from 1, the 
+* first is the middle method, and the children of method k are methods 
+* 2k and 2k+1. The first levels of the implicit tree share a few cache 
+* lines, and findMethodInSortedMethodList() searches it without 
+* data-dependent branches. Such lists are marked METHOD_LIST_EYTZINGER.
+* Lists from the shared cache are read-only and stay sorted.
+**********************************************************************/
+
+// Smaller lists stay sorted.
+enum { MethodListEytzingerMinCount = 64 };
+
+static uint32_t 
+fillEytzingerMethodList(method_list_t *mlist, const method_t *sorted, 
+                        uint32_t next, uint32_t k)
+{
+    // In-order traversal of the implicit tree visits the sorted order.
+    if (k <= mlist->count) {
+        next = fillEytzingerMethodList(mlist, sorted, next, 2*k);
+        mlist->get(k-1) = sorted[next++];
+        next = fillEytzingerMethodList(mlist, sorted, next, 2*k+1);
+    }
+    return next;
+}
+
+static void 
+makeEytzingerMethodList(method_list_t *mlist)
+{
+    runtimeLock.assertWriting();
+    assert(mlist->entsize() == sizeof(method_t));
+
+    method_t *sorted = (method_t *)
+        memdup(&mlist->first, mlist->count * sizeof(method_t));
+    fillEytzingerMethodList(mlist, sorted, 0, 1);
+    free(sorted);
+
+    mlist->entsizeAndFlags |= METHOD_LIST_EYTZINGER;
+}
+
+
 static void 
 fixupMethodList(method_list_t *mlist, bool bundleCopy, bool sort)
 {
@@ -563,6 +609,12 @@ fixupMethodList(method_list_t *mlist, bool bundleCopy, bool sort)
     
     // Mark method list as uniqued and sorted
     mlist->setFixedUp();
+
+    if (sort  &&  mlist->count >= MethodListEytzingerMinCount  &&  
+        mlist->entsize() == sizeof(method_t))
+    {
+        makeEytzingerMethodList(mlist);
+    }
 }
 
 
@@ -662,6 +714,8 @@ attachCategories(Class cls, category_list *cats, bool flush_caches)
 
     prepareMethodLists(cls, mlists, mcount, NO, fromBundle);
     rw->methods.attachLists(mlists, mcount);
+    rememberMethodListOwner(cls, mlists, mcount);
+    discardMethodTable(cls);
     free(mlists);
     if (flush_caches  &&  mcount > 0) flushCaches(cls);
 
@@ -698,6 +752,8 @@ static void methodizeClass(Class cls)
     if (list) {
         prepareMethodLists(cls, &list, 1, YES, isBundleClass(cls));
         rw->methods.attachLists(&list, 1);
+        rememberMethodListOwner(cls, &list, 1);
+        discardMethodTable(cls);
     }
 
     property_list_t *proplist = ro->baseProperties;
@@ -1953,11 +2009,13 @@ static void flushCaches(Class cls)
     if (cls) {
         foreach_realized_class_and_subclass(cls, ^(Class c){
             cache_erase_nolock(c);
+            discardMethodLookupCache(c);
         });
     }
     else {
         foreach_realized_class_and_metaclass(^(Class c){
             cache_erase_nolock(c);
+            discardMethodLookupCache(c);
         });
     }
 }
@@ -2845,6 +2903,245 @@ method_getTypeEncoding(Method m)
 }
 
 
+/***********************************************************************
+* Method owners
+* Methods known externally (e.g. from class_getInstanceMethod) do not 
+* say which class they belong to. Every method list is recorded with 
+* its class when it is attached, and methodOwner() finds the list 
+* holding a method by binary search. The records are sorted lazily and 
+* forgotten when their class is freed. A list recorded again at the 
+* same address (e.g. after its image was unloaded and another loaded 
+* there) belongs to the newer class. Lists shared by a duplicated class 
+* keep the original class as their owner.
+* Locking: runtimeLock must be held for writing.
+**********************************************************************/
+struct method_list_owner_t {
+    method_list_t *mlist;
+    Class cls;
+
+    bool operator < (const method_list_owner_t& other) const {
+        return (uintptr_t)mlist < (uintptr_t)other.mlist;
+    }
+};
+
+static method_list_owner_t *methodListOwners;
+static uint32_t methodListOwnerCount;
+static uint32_t methodListOwnerCapacity;
+static bool methodListOwnersSorted = true;
+
+static void rememberMethodListOwner(Class cls, 
+                                    method_list_t **mlists, int count)
+{
+    runtimeLock.assertWriting();
+
+    if (methodListOwnerCount + count > methodListOwnerCapacity) {
+        uint32_t newCapacity = methodListOwnerCapacity ? 
+            methodListOwnerCapacity * 2 : 64;
+        while (newCapacity < methodListOwnerCount + count) newCapacity *= 2;
+        methodListOwners = (method_list_owner_t *)
+            realloc(methodListOwners, newCapacity * sizeof(*methodListOwners));
+        methodListOwnerCapacity = newCapacity;
+    }
+
+    for (int i = 0; i < count; i++) {
+        methodListOwners[methodListOwnerCount++] = { mlists[i], cls };
+    }
+    if (count > 0) methodListOwnersSorted = false;
+}
+
+static Class methodOwner(method_t *m)
+{
+    runtimeLock.assertWriting();
+
+    method_list_owner_t *owners = methodListOwners;
+
+    if (!methodListOwnersSorted) {
+        // Stable, so the newest record of a list sorts last. Keep it.
+        std::stable_sort(owners, owners + methodListOwnerCount);
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < methodListOwnerCount; i++) {
+            if (count > 0  &&  owners[count-1].mlist == owners[i].mlist) {
+                count--;
+            }
+            owners[count++] = owners[i];
+        }
+        methodListOwnerCount = count;
+        methodListOwnersSorted = true;
+    }
+
+    // Find the last list that starts at or before m.
+    uint32_t lo = 0;
+    uint32_t hi = methodListOwnerCount;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if ((uintptr_t)owners[mid].mlist <= (uintptr_t)m) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return nil;
+
+    method_list_owner_t& owner = owners[lo-1];
+    if (!owner.mlist->containsMethod(m)) return nil;
+    return owner.cls;
+}
+
+static void forgetMethodOwners(Class cls)
+{
+    runtimeLock.assertWriting();
+
+    // Compacting keeps the records in order.
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < methodListOwnerCount; i++) {
+        if (methodListOwners[i].cls != cls) {
+            methodListOwners[count++] = methodListOwners[i];
+        }
+    }
+    methodListOwnerCount = count;
+}
+
+
+/***********************************************************************
+* method_update_batch_t
+* Method changes made by objc_replaceMethods() and 
+* objc_exchangeMethodImplementations(). Cache invalidations are 
+* collected and performed in one pass when the batch is committed. 
+* Added methods are collected into one method list per class, which 
+* is prepared and attached when the batch is committed.
+* Locking: runtimeLock must be held for writing.
+**********************************************************************/
+struct method_update_batch_t {
+    SEL *sels;
+    size_t selCount;
+    size_t selCapacity;
+
+    struct new_methods_t {
+        method_list_t *mlist;
+        uint32_t capacity;
+    };
+    objc::DenseMap<Class, new_methods_t> newMethods;
+
+    method_update_batch_t() : sels(nil), selCount(0), selCapacity(0) { }
+    ~method_update_batch_t() { free(sels); }
+
+    void addSelector(SEL sel);
+    method_t *findNewMethod(Class cls, SEL name);
+    void addNewMethod(Class cls, SEL name, IMP imp, const char *types);
+    void commit();
+};
+
+// The batch in progress, or nil.
+static method_update_batch_t *methodUpdateBatch;
+
+
+void method_update_batch_t::addSelector(SEL sel)
+{
+    if (selCount == selCapacity) {
+        selCapacity = selCapacity ? selCapacity*2 : 16;
+        sels = (SEL *)realloc(sels, selCapacity * sizeof(SEL));
+    }
+    sels[selCount++] = sel;
+}
+
+method_t *method_update_batch_t::findNewMethod(Class cls, SEL name)
+{
+    auto it = newMethods.find(cls);
+    if (it == newMethods.end()) return nil;
+
+    for (auto& meth : *it->second.mlist) {
+        if (meth.name == name) return &meth;
+    }
+    return nil;
+}
+
+void method_update_batch_t::addNewMethod(Class cls, SEL name, IMP imp, 
+                                         const char *types)
+{
+    new_methods_t& pending = newMethods[cls];
+    if (!pending.mlist  ||  pending.mlist->count == pending.capacity) {
+        uint32_t newCapacity = pending.capacity ? pending.capacity*2 : 4;
+        pending.mlist = (method_list_t *)
+            realloc(pending.mlist, sizeof(method_list_t) + 
+                    (newCapacity-1) * sizeof(method_t));
+        if (pending.capacity == 0) {
+            // Not fixed up: prepareMethodLists() sorts it.
+            pending.mlist->entsizeAndFlags = (uint32_t)sizeof(method_t);
+            pending.mlist->count = 0;
+        }
+        pending.capacity = newCapacity;
+    }
+
+    method_t& meth = pending.mlist->getOrEnd(pending.mlist->count++);
+    meth.name = name;
+    meth.types = strdupIfMutable(types);
+    meth.imp = imp;
+
+    addSelector(name);
+}
+
+void method_update_batch_t::commit()
+{
+    runtimeLock.assertWriting();
+
+    for (auto& pair : newMethods) {
+        Class cls = pair.first;
+        method_list_t *mlist = pair.second.mlist;
+        prepareMethodLists(cls, &mlist, 1, NO, NO);
+        cls->data()->methods.attachLists(&mlist, 1);
+        rememberMethodListOwner(cls, &mlist, 1);
+        discardMethodTable(cls);
+        foreach_realized_class_and_subclass(cls, ^(Class c){
+            discardMethodLookupCache(c);
+        });
+    }
+
+    if (selCount == 0) return;
+
+    // Sort and unique the selectors for cache_erase_sels_nolock().
+    std::sort(sels, sels + selCount);
+    selCount = std::unique(sels, sels + selCount) - sels;
+
+    // A selector is removed from every class's cache, not only 
+    // from the classes that inherit the changed method. 
+    // That is one pass over the classes however many changes there are.
+    mutex_locker_t lock(cacheUpdateLock);
+    foreach_realized_class_and_metaclass(^(Class c){
+        cache_erase_sels_nolock(c, sels, selCount);
+    });
+}
+
+
+/***********************************************************************
+* flushCachesForMethod
+* Removes cache entries that may hold m's previous implementation: 
+* those for m's selector in cls and its subclasses, or in every class 
+* if cls is nil (i.e. unknown). All other cache entries are kept.
+* Inside a batch of method updates the removal is deferred.
+* Locking: runtimeLock must be held for writing.
+**********************************************************************/
+static void flushCachesForMethod(Class cls, method_t *m)
+{
+    runtimeLock.assertWriting();
+
+    if (methodUpdateBatch) {
+        methodUpdateBatch->addSelector(m->name);
+        return;
+    }
+
+    mutex_locker_t lock(cacheUpdateLock);
+
+    SEL sel = m->name;
+    if (cls) {
+        foreach_realized_class_and_subclass(cls, ^(Class c){
+            cache_erase_sel_nolock(c, sel);
+        });
+    }
+    else {
+        foreach_realized_class_and_metaclass(^(Class c){
+            cache_erase_sel_nolock(c, sel);
+        });
+    }
+}
+
+
 /***********************************************************************
 * method_setImplementation
 * Sets this method's implementation to imp.
@@ -2861,11 +3158,10 @@ _method_setImplementation(Class cls, method_t *m, IMP imp)
     IMP old = m->imp;
     m->imp = imp;
 
-    // Cache updates are slow if cls is nil (i.e. unknown)
-    // RR/AWZ updates are slow if cls is nil (i.e. unknown)
-    // fixme build list of classes whose Methods are known externally?
+    // Cache and RR/AWZ updates are slow if cls is nil (i.e. unknown)
+    if (!cls) cls = methodOwner(m);
 
-    flushCaches(cls);
+    flushCachesForMethod(cls, m);
 
     updateCustomRR_AWZ(cls, m);
 
@@ -2875,32 +3171,40 @@ _method_setImplementation(Class cls, method_t *m, IMP imp)
 IMP 
 method_setImplementation(Method m, IMP imp)
 {
-    // Don't know the class - will be slow if RR/AWZ are affected
-    // fixme build list of classes whose Methods are known externally?
+    // Don't know the class. _method_setImplementation looks it up.
     rwlock_writer_t lock(runtimeLock);
     return _method_setImplementation(Nil, m, imp);
 }
 
 
-void method_exchangeImplementations(Method m1, Method m2)
+static void
+exchangeImplementations(method_t *m1, method_t *m2)
 {
-    if (!m1  ||  !m2) return;
-
-    rwlock_writer_t lock(runtimeLock);
+    runtimeLock.assertWriting();
 
     IMP m1_imp = m1->imp;
     m1->imp = m2->imp;
     m2->imp = m1_imp;
 
+    // Cache and RR/AWZ updates are slow if a class is nil (i.e. unknown)
+    // A batch removes the selectors from every class's cache anyway, 
+    // so don't search for the classes one method at a time.
+    Class cls1 = methodUpdateBatch ? Nil : methodOwner(m1);
+    Class cls2 = methodUpdateBatch ? Nil : methodOwner(m2);
+
+    flushCachesForMethod(cls1, m1);
+    flushCachesForMethod(cls2, m2);
 
-    // RR/AWZ updates are slow because class is unknown
-    // Cache updates are slow because class is unknown
-    // fixme build list of classes whose Methods are known externally?
+    updateCustomRR_AWZ(cls1, m1);
+    updateCustomRR_AWZ(cls2, m2);
+}
 
-    flushCaches(nil);
+void method_exchangeImplementations(Method m1, Method m2)
+{
+    if (!m1  ||  !m2) return;
 
-    updateCustomRR_AWZ(nil, m1);
-    updateCustomRR_AWZ(nil, m2);
+    rwlock_writer_t lock(runtimeLock);
+    exchangeImplementations(m1, m2);
 }
 
 
@@ -4376,6 +4680,22 @@ static method_t *findMethodInSortedMethodList(SEL key, const method_list_t *list
     const method_t *probe;
     uintptr_t keyValue = (uintptr_t)key;
     uint32_t count;
+
+    if (list->isEytzinger()) {
+        // Method k of the implicit tree is first[k-1].
+        uint32_t i = 1;
+        for (count = list->count; i <= count; ) {
+            // Prefetch the children four levels down.
+            __builtin_prefetch(first + 16*i - 1);
+            i = 2*i + ((uintptr_t)first[i-1].name < keyValue);
+        }
+        // Undo the moves right since the last move left. 
+        // That method is the first one not less than key, 
+        // which is the first occurrence of key if there is one.
+        i >>= __builtin_ffs(~i);
+        if (i == 0  ||  (uintptr_t)first[i-1].name != keyValue) return nil;
+        return (method_t *)&first[i-1];
+    }
     
     for (count = list->count; count != 0; count >>= 1) {
         probe = base + (count >> 1);
@@ -4434,6 +4754,125 @@ static method_t *search_method_list(const method_list_t *mlist, SEL sel)
     return nil;
 }
 
+/***********************************************************************
+* method_table_t
+* A class's method lists merged into one table sorted by selector 
+* address, for OBJC_FLATTEN_METHOD_LISTS. Each selector appears once, 
+* with the method that searching the lists in order would find first, 
+* so category methods override as usual.
+* The selectors are kept apart from the method pointers so a search 
+* touches only the selectors until it succeeds.
+**********************************************************************/
+struct method_table_t {
+    uint32_t count;
+    // followed by SEL sels[count], then method_t *methods[count]
+
+    SEL *sels() { return (SEL *)(this + 1); }
+    method_t **methods() { return (method_t **)(sels() + count); }
+
+    method_t *find(SEL sel) {
+        SEL *base = sels();
+        uint32_t lo = 0, hi = count;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (base[mid] == sel) return methods()[mid];
+            if ((uintptr_t)base[mid] < (uintptr_t)sel) lo = mid + 1;
+            else hi = mid;
+        }
+        return nil;
+    }
+};
+
+// Don't bother with a table for a class with only one method list.
+enum { MethodTableMinLists = 2 };
+
+struct MethodPtrSortBySELAddress {
+    bool operator() (const method_t *lhs, const method_t *rhs)
+    { return (uintptr_t)lhs->name < (uintptr_t)rhs->name; }
+};
+
+
+/***********************************************************************
+* buildMethodTable
+* Builds and installs cls's method table.
+* Several threads may build the table at once. One of them wins.
+* Locking: runtimeLock must be read- or write-locked by the caller
+**********************************************************************/
+static method_table_t *buildMethodTable(Class cls)
+{
+    runtimeLock.assertLocked();
+
+    auto rw = cls->data();
+
+    // Collect every method in search order. 
+    // The stable sort keeps the first of each selector first.
+    // A list in Eytzinger order is not in search order, so use 
+    // the method a search of that list finds for each selector.
+    uint32_t total = rw->methods.count();
+    method_t **all = (method_t **)malloc(total * sizeof(method_t *));
+    uint32_t n = 0;
+    for (auto mlists = rw->methods.beginLists(), 
+              end = rw->methods.endLists(); 
+         mlists != end; 
+         ++mlists)
+    {
+        const method_list_t *mlist = *mlists;
+        for (auto& meth : *mlist) {
+            all[n++] = mlist->isEytzinger() 
+                ? findMethodInSortedMethodList(meth.name, mlist) : &meth;
+        }
+    }
+    std::stable_sort(all, all + n, MethodPtrSortBySELAddress());
+
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (i == 0  ||  all[i]->name != all[i-1]->name) unique++;
+    }
+
+    method_table_t *table = (method_table_t *)
+        malloc(sizeof(method_table_t) + 
+               unique * (sizeof(SEL) + sizeof(method_t *)));
+    table->count = unique;
+    SEL *sels = table->sels();
+    method_t **methods = table->methods();
+    uint32_t j = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (i == 0  ||  all[i]->name != all[i-1]->name) {
+            sels[j] = all[i]->name;
+            methods[j] = all[i];
+            j++;
+        }
+    }
+    free(all);
+
+    if (! OSAtomicCompareAndSwapPtrBarrier(nil, table, 
+                                           (void * volatile *)&rw->methodTable))
+    {
+        free(table);
+        table = rw->methodTable;
+    }
+
+    return table;
+}
+
+
+/***********************************************************************
+* discardMethodTable
+* Frees cls's method table, if any. Call after attaching method lists.
+* Locking: runtimeLock must be write-locked by the caller
+**********************************************************************/
+static void discardMethodTable(Class cls)
+{
+    runtimeLock.assertWriting();
+
+    auto rw = cls->data();
+    if (rw->methodTable) {
+        free(rw->methodTable);
+        rw->methodTable = nil;
+    }
+}
+
+
 static method_t *
 getMethodNoSuper_nolock(Class cls, SEL sel)
 {
@@ -4443,6 +4882,16 @@ getMethodNoSuper_nolock(Class cls, SEL sel)
     // fixme nil cls? 
     // fixme nil sel?
 
+    if (FlattenMethodLists) {
+        method_table_t *table = cls->data()->methodTable;
+        if (!table  &&  
+            cls->data()->methods.countLists() >= MethodTableMinLists) 
+        {
+            table = buildMethodTable(cls);
+        }
+        if (table) return table->find(sel);
+    }
+
     for (auto mlists = cls->data()->methods.beginLists(), 
               end = cls->data()->methods.endLists(); 
          mlists != end;
@@ -4481,15 +4930,166 @@ getMethod_nolock(Class cls, SEL sel)
 }
 
 
+/***********************************************************************
+* method_lookup_cache_t
+* A class's class_getInstanceMethod() results, keyed by selector. 
+* MethodLookupMissing records that the class and its superclasses 
+* have no such method, even after the resolver ran.
+* Readers hold runtimeLock for reading and take no other lock. 
+* Writers also hold methodLookupCacheLock. A writer never changes an 
+* entry once its selector is set, and a reader that sees the selector 
+* before the method treats the entry as a miss.
+* A table that fills up is replaced. The old one is freed the next time 
+* runtimeLock is held for writing, when no reader can still see it.
+* Tables are discarded by flushCaches(), which runs whenever a class 
+* gains methods or changes its superclass. Setting an IMP leaves the 
+* method_t where it was, so it doesn't affect these results.
+**********************************************************************/
+struct method_lookup_cache_t {
+    uint32_t mask;
+    uint32_t occupied;
+    method_lookup_cache_t *nextGarbage;
+    // followed by entry_t entries[mask+1]
+
+    struct entry_t {
+        SEL sel;
+        method_t *meth;
+    };
+
+    entry_t *entries() { return (entry_t *)(this + 1); }
+
+    // Returns nil if sel hasn't been looked up yet.
+    method_t *find(SEL sel) {
+        entry_t *e = entries();
+        uint32_t i = (uint32_t)(uintptr_t)sel & mask;
+        SEL s;
+        while ((s = e[i].sel)) {
+            if (s == sel) return e[i].meth;
+            i = (i+1) & mask;
+        }
+        return nil;
+    }
+
+    void insert(SEL sel, method_t *meth) {
+        entry_t *e = entries();
+        uint32_t i = (uint32_t)(uintptr_t)sel & mask;
+        while (e[i].sel) {
+            if (e[i].sel == sel) return;
+            i = (i+1) & mask;
+        }
+        e[i].meth = meth;
+        OSMemoryBarrier();
+        e[i].sel = sel;
+        occupied++;
+    }
+};
+
+#define MethodLookupMissing ((method_t *)~(uintptr_t)0)
+
+enum { MethodLookupCacheInitialSize = 8 };
+
+static mutex_t methodLookupCacheLock;
+
+// Replaced tables. Freed with runtimeLock write-locked.
+static method_lookup_cache_t *methodLookupCacheGarbage;
+
+
+/***********************************************************************
+* findMethodLookup
+* Looks for a previous class_getInstanceMethod(cls, sel) result.
+* Returns true and sets *outMethod (possibly to nil) if there is one.
+* Locking: read-locks runtimeLock
+**********************************************************************/
+static bool findMethodLookup(Class cls, SEL sel, method_t **outMethod)
+{
+    rwlock_reader_t lock(runtimeLock);
+
+    if (!cls->isRealized()) return false;
+    method_lookup_cache_t *table = cls->data()->methodLookupCache;
+    if (!table) return false;
+
+    method_t *m = table->find(sel);
+    if (!m) return false;
+    *outMethod = (m == MethodLookupMissing) ? nil : m;
+    return true;
+}
+
+
+/***********************************************************************
+* cacheMethodLookup
+* Records m (possibly nil) as the class_getInstanceMethod(cls, sel) result.
+* Locking: runtimeLock must be read- or write-locked by the caller. 
+* Acquires methodLookupCacheLock.
+**********************************************************************/
+static void cacheMethodLookup(Class cls, SEL sel, method_t *m)
+{
+    runtimeLock.assertLocked();
+    assert(cls->isRealized());
+
+    mutex_locker_t lock(methodLookupCacheLock);
+
+    auto rw = cls->data();
+    method_lookup_cache_t *table = rw->methodLookupCache;
+
+    // Keep the table at most 3/4 full.
+    if (!table  ||  (table->occupied + 1) * 4 > (table->mask + 1) * 3) {
+        uint32_t newSize = table ? (table->mask + 1) * 2 
+                                 : MethodLookupCacheInitialSize;
+        method_lookup_cache_t *newTable = (method_lookup_cache_t *)
+            calloc(sizeof(method_lookup_cache_t) + 
+                   newSize * sizeof(method_lookup_cache_t::entry_t), 1);
+        newTable->mask = newSize - 1;
+        if (table) {
+            auto e = table->entries();
+            for (uint32_t i = 0; i <= table->mask; i++) {
+                if (e[i].sel) newTable->insert(e[i].sel, e[i].meth);
+            }
+            table->nextGarbage = methodLookupCacheGarbage;
+            methodLookupCacheGarbage = table;
+        }
+        OSMemoryBarrier();
+        rw->methodLookupCache = newTable;
+        table = newTable;
+    }
+
+    table->insert(sel, m ?: MethodLookupMissing);
+}
+
+
+/***********************************************************************
+* discardMethodLookupCache
+* Frees cls's class_getInstanceMethod() results, and any replaced tables.
+* Locking: runtimeLock must be write-locked by the caller
+**********************************************************************/
+static void discardMethodLookupCache(Class cls)
+{
+    runtimeLock.assertWriting();
+
+    auto rw = cls->data();
+    if (rw->methodLookupCache) {
+        free(rw->methodLookupCache);
+        rw->methodLookupCache = nil;
+    }
+
+    while (method_lookup_cache_t *table = methodLookupCacheGarbage) {
+        methodLookupCacheGarbage = table->nextGarbage;
+        free(table);
+    }
+}
+
+
 /***********************************************************************
 * _class_getMethod
-* fixme
+* Searches cls and its superclasses for sel, and remembers the result 
+* for class_getInstanceMethod().
 * Locking: read-locks runtimeLock
 **********************************************************************/
 static Method _class_getMethod(Class cls, SEL sel)
 {
     rwlock_reader_t lock(runtimeLock);
-    return getMethod_nolock(cls, sel);
+    method_t *m = getMethod_nolock(cls, sel);
+    cacheMethodLookup(cls, sel, m);
+    return m;
 }
 
 
@@ -4506,14 +5106,15 @@ Method class_getInstanceMethod(Class cls, SEL sel)
     // This implementation is a bit weird because it's the only place that 
     // wants a Method instead of an IMP.
 
-#warning fixme build and search caches
+    // Answer repeated queries, including failed ones, 
+    // without searching or running the resolver again.
+    method_t *m;
+    if (findMethodLookup(cls, sel, &m)) return m;
         
     // Search method lists, try method resolver, etc.
     lookUpImpOrNil(cls, sel, nil, 
                    NO/*initialize*/, NO/*cache*/, YES/*resolver*/);
 
-#warning fixme build and search caches
-
     return _class_getMethod(cls, sel);
 }
 
@@ -4575,6 +5176,9 @@ IMP lookUpImpOrForward(Class cls, SEL sel, id inst,
 
     runtimeLock.assertUnlocked();
 
+    // The messenger misses in every cache until this thread registers.
+    cache_reader_register();
+
     // Optimistic cache lookup
     if (cache) {
         imp = cache_getImp(cls, sel);
@@ -5401,13 +6005,20 @@ addMethod(Class cls, SEL name, IMP imp, const char *types, bool replace)
     assert(cls->isRealized());
 
     method_t *m;
-    if ((m = getMethodNoSuper_nolock(cls, name))) {
+    if ((m = getMethodNoSuper_nolock(cls, name))  ||  
+        (methodUpdateBatch  &&  
+         (m = methodUpdateBatch->findNewMethod(cls, name))))
+    {
         // already exists
         if (!replace) {
             result = m->imp;
         } else {
             result = _method_setImplementation(cls, m, imp);
         }
+    } else if (methodUpdateBatch) {
+        // Attached with the batch's other new methods for cls.
+        methodUpdateBatch->addNewMethod(cls, name, imp, types);
+        result = nil;
     } else {
         // fixme optimize
         method_list_t *newlist;
@@ -5421,6 +6032,8 @@ addMethod(Class cls, SEL name, IMP imp, const char *types, bool replace)
 
         prepareMethodLists(cls, &newlist, 1, NO, NO);
         cls->data()->methods.attachLists(&newlist, 1);
+        rememberMethodListOwner(cls, &newlist, 1);
+        discardMethodTable(cls);
         flushCaches(cls);
 
         result = nil;
@@ -5450,6 +6063,66 @@ class_replaceMethod(Class cls, SEL name, IMP imp, const char *types)
 }
 
 
+/***********************************************************************
+* objc_replaceMethods
+* Performs class_replaceMethod() for each replacement, in order.
+* The runtime lock is taken once, and caches are updated once.
+* Previous implementations are returned in outOldImps if non-nil.
+* Locking: acquires runtimeLock
+**********************************************************************/
+void
+objc_replaceMethods(const objc_method_replacement_t *replacements, 
+                    unsigned int count, IMP *outOldImps)
+{
+    if (!replacements  ||  count == 0) return;
+
+    rwlock_writer_t lock(runtimeLock);
+
+    method_update_batch_t batch;
+    methodUpdateBatch = &batch;
+
+    for (unsigned int i = 0; i < count; i++) {
+        const objc_method_replacement_t& r = replacements[i];
+        IMP old = nil;
+        if (r.cls  &&  r.name  &&  r.imp) {
+            old = addMethod(r.cls, r.name, r.imp, r.types ?: "", YES);
+        }
+        if (outOldImps) outOldImps[i] = old;
+    }
+
+    methodUpdateBatch = nil;
+    batch.commit();
+}
+
+
+/***********************************************************************
+* objc_exchangeMethodImplementations
+* Performs method_exchangeImplementations(methods[2*i], methods[2*i+1]) 
+* for each of pairCount pairs, in order.
+* The runtime lock is taken once, and caches are updated once.
+* Locking: acquires runtimeLock
+**********************************************************************/
+void
+objc_exchangeMethodImplementations(Method *methods, unsigned int pairCount)
+{
+    if (!methods  ||  pairCount == 0) return;
+
+    rwlock_writer_t lock(runtimeLock);
+
+    method_update_batch_t batch;
+    methodUpdateBatch = &batch;
+
+    for (unsigned int i = 0; i < pairCount; i++) {
+        method_t *m1 = methods[2*i];
+        method_t *m2 = methods[2*i+1];
+        if (m1  &&  m2) exchangeImplementations(m1, m2);
+    }
+
+    methodUpdateBatch = nil;
+    batch.commit();
+}
+
+
 /***********************************************************************
 * class_addIvar
 * Adds an ivar to a class.
@@ -5976,6 +6649,9 @@ static void free_class(Class cls)
     auto ro = rw->ro;
 
     cache_delete(cls);
+    forgetMethodOwners(cls);
+    discardMethodTable(cls);
+    discardMethodLookupCache(cls);
     
     for (auto& meth : rw->methods) {
         try_free(meth.types);
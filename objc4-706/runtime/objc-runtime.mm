@@ -290,6 +290,8 @@ void environ_init(void)
         }
     }
 
+    if (PrintPoolStatistics) RecordPoolStatistics = true;
+
     // Print OBJC_HELP and OBJC_PRINT_OPTIONS output.
     if (PrintHelp  ||  PrintOptions) {
         if (PrintHelp) {
@@ -578,6 +580,78 @@ objc_copyClassNamesForImage(const char *image, unsigned int *outCount)
 }
 	
 
+/**********************************************************************
+* objc_copyLockContention
+* Returns a malloc'd snapshot of the contention counters of every 
+* runtime spinlock that has been taken, or nil if the runtime was 
+* built without SUPPORT_LOCK_CONTENTION_STATS.
+* Locking: none. The counters are read racily.
+**********************************************************************/
+#if SUPPORT_LOCK_CONTENTION_STATS
+
+struct lock_contention_list_t {
+    objc_lock_contention_t *list;
+    unsigned int count;
+    unsigned int capacity;
+};
+
+static void countLock(const char *, unsigned int, spinlock_t&, void *ctx)
+{
+    ((lock_contention_list_t *)ctx)->capacity++;
+}
+
+static void copyLockContention(const char *name, unsigned int index, 
+                               spinlock_t& lock, void *ctx)
+{
+    lock_contention_list_t *locks = (lock_contention_list_t *)ctx;
+    const lock_contention_t& stats = lock.contention();
+    if (stats.acquisitions == 0) return;
+    if (locks->count == locks->capacity) return;
+
+    objc_lock_contention_t& out = locks->list[locks->count++];
+    out.name = name;
+    out.index = index;
+    out.acquisitions = stats.acquisitions;
+    out.contended = stats.contended;
+    out.spins = stats.spins;
+    out.parks = stats.parks;
+}
+
+objc_lock_contention_t *
+objc_copyLockContention(unsigned int *outCount)
+{
+    lock_contention_list_t locks = { nil, 0, 0 };
+    sidetable_visitLocks(countLock, &locks);
+    sync_visitLocks(countLock, &locks);
+    associations_visitLocks(countLock, &locks);
+
+    locks.list = (objc_lock_contention_t *)
+        calloc(locks.capacity, sizeof(*locks.list));
+    sidetable_visitLocks(copyLockContention, &locks);
+    sync_visitLocks(copyLockContention, &locks);
+    associations_visitLocks(copyLockContention, &locks);
+
+    if (locks.count == 0) {
+        free(locks.list);
+        locks.list = nil;
+    }
+
+    if (outCount) *outCount = locks.count;
+    return locks.list;
+}
+
+#else
+
+objc_lock_contention_t *
+objc_copyLockContention(unsigned int *outCount)
+{
+    if (outCount) *outCount = 0;
+    return nil;
+}
+
+#endif
+
+
 /**********************************************************************
 * Fast Enumeration Support
 **********************************************************************/
@@ -68,6 +68,13 @@ struct SyncList {
 #define LIST_FOR_OBJ(obj) sDataLists[obj].data
 static StripedMap<SyncList> sDataLists;
 
+void sync_visitLocks(spinlock_visitor_t visitor, void *context)
+{
+    for (unsigned int i = 0; i < sDataLists.stripeCount(); i++) {
+        visitor("SyncList", i, sDataLists.stripeAt(i).lock, context);
+    }
+}
+
 
 enum usage { ACQUIRE, RELEASE, CHECK };
 
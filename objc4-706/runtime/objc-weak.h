@@ -67,6 +67,9 @@ typedef DisguisedPtr<objc_object *> weak_referrer_t;
  * a hash set of weak references pointing to an object.
  * If out_of_line_ness != REFERRERS_OUT_OF_LINE then the set
  * is instead a small inline array.
+ * Out of line, referrers is a dense array of num_refs referrers, 
+ * and index is a Robin Hood hash table of positions in it (plus one; 
+ * zero is empty) with mask+1 slots. Both share one allocation.
  */
 #define WEAK_INLINE_COUNT 4
 
@@ -85,7 +88,7 @@ struct weak_entry_t {
             uintptr_t        out_of_line_ness : 2;
             uintptr_t        num_refs : PTR_MINUS_2;
             uintptr_t        mask;
-            uintptr_t        max_hash_displacement;
+            uint32_t        *index;
         };
         struct {
             // out_of_line_ness field is low bits of inline_referrers[1]
@@ -138,6 +141,25 @@ bool weak_is_registered_no_lock(weak_table_t *weak_table, id referent);
 /// Called on object destruction. Sets all remaining weak pointers to nil.
 void weak_clear_no_lock(weak_table_t *weak_table, id referent);
 
+/// Footprint and shape of a weak table.
+struct weak_table_stats_t {
+    size_t entries;               // weakly referenced objects
+    size_t capacity;              // slots in the table
+    size_t table_bytes;           // bytes allocated for the table
+    size_t referrers;             // weak references to all entries
+    size_t out_of_line_entries;   // entries with out-of-line referrers
+    size_t out_of_line_bytes;     // bytes allocated for those referrers
+    size_t max_displacement;      // longest probe in the table
+    size_t max_referrer_displacement;  // longest probe in any referrer index
+};
+
+/// Measures a weak table.
+void weak_table_stats_no_lock(weak_table_t *weak_table, 
+                              weak_table_stats_t *stats);
+
+/// Shrinks a weak table and its referrer sets to fit. Returns bytes freed.
+size_t weak_compact_no_lock(weak_table_t *weak_table);
+
 __END_DECLS
 
 #endif /* _OBJC_WEAK_H_ */
@@ -32,8 +32,6 @@
 
 #define TABLE_SIZE(entry) (entry->mask ? entry->mask + 1 : 0)
 
-static void append_referrer(weak_entry_t *entry, objc_object **new_referrer);
-
 BREAKPOINT_FUNCTION(
     void objc_weak_error(void)
 );
@@ -66,39 +64,87 @@ static inline uintptr_t w_hash_pointer(objc_object **key) {
     return ptr_hash((uintptr_t)key);
 }
 
+// Referrers an out-of-line entry has room for: 3/4 of its index slots.
+#define REFS_CAPACITY(entry) (TABLE_SIZE(entry) / 4 * 3)
+
+// Index slot where referrer's probe sequence starts.
+static inline size_t home_slot(weak_entry_t *entry, objc_object **referrer)
+{
+    return w_hash_pointer(referrer) & entry->mask;
+}
+
+// Probe distance of the referrer in index slot i.
+static inline size_t probe_distance(weak_entry_t *entry, size_t i)
+{
+    objc_object **referrer = entry->referrers[entry->index[i] - 1];
+    return (i - home_slot(entry, referrer)) & entry->mask;
+}
+
 /** 
- * Grow the entry's hash table of referrers. Rehashes each
- * of the referrers.
- * 
- * @param entry Weak pointer hash set for a particular object.
+ * Return the index slot of referrer, or -1 if it is not in the set.
+ * Robin Hood ordering lets a miss stop as soon as it passes 
+ * a referrer closer to its home slot than the probe is.
  */
-__attribute__((noinline, used))
-static void grow_refs_and_insert(weak_entry_t *entry, 
-                                 objc_object **new_referrer)
+static ssize_t find_referrer(weak_entry_t *entry, objc_object **referrer)
 {
     assert(entry->out_of_line());
 
-    size_t old_size = TABLE_SIZE(entry);
-    size_t new_size = old_size ? old_size * 2 : 8;
+    size_t i = home_slot(entry, referrer);
+    for (size_t distance = 0; entry->index[i] != 0; distance++) {
+        if (entry->referrers[entry->index[i] - 1] == referrer) return i;
+        if (probe_distance(entry, i) < distance) break;
+        i = (i+1) & entry->mask;
+    }
+    return -1;
+}
 
+/** 
+ * Insert position pos of the referrers array into the index, 
+ * displacing any referrer that is closer to its home slot.
+ */
+static void index_referrer(weak_entry_t *entry, size_t pos)
+{
+    uint32_t slot = (uint32_t)(pos + 1);
+    size_t i = home_slot(entry, entry->referrers[pos]);
+    size_t distance = 0;
+    while (entry->index[i] != 0) {
+        size_t other = probe_distance(entry, i);
+        if (other < distance) {
+            uint32_t displaced = entry->index[i];
+            entry->index[i] = slot;
+            slot = displaced;
+            distance = other;
+        }
+        i = (i+1) & entry->mask;
+        distance++;
+    }
+    entry->index[i] = slot;
+}
+
+/** 
+ * Reallocate an out-of-line entry's referrers and index for 
+ * new_size index slots, and rebuild the index.
+ * 
+ * @param entry Weak pointer hash set for a particular object.
+ */
+static void resize_refs(weak_entry_t *entry, 
+                        weak_referrer_t *old_refs, size_t new_size)
+{
     size_t num_refs = entry->num_refs;
-    weak_referrer_t *old_refs = entry->referrers;
+    size_t capacity = new_size / 4 * 3;
+    assert(num_refs <= capacity);
+
+    weak_referrer_t *new_refs = (weak_referrer_t *)
+        calloc(1, capacity * sizeof(weak_referrer_t) + 
+                  new_size * sizeof(uint32_t));
+    memcpy(new_refs, old_refs, num_refs * sizeof(weak_referrer_t));
+
+    entry->referrers = new_refs;
+    entry->index = (uint32_t *)(new_refs + capacity);
     entry->mask = new_size - 1;
-    
-    entry->referrers = (weak_referrer_t *)
-        calloc(TABLE_SIZE(entry), sizeof(weak_referrer_t));
-    entry->num_refs = 0;
-    entry->max_hash_displacement = 0;
-    
-    for (size_t i = 0; i < old_size && num_refs > 0; i++) {
-        if (old_refs[i] != nil) {
-            append_referrer(entry, old_refs[i]);
-            num_refs--;
-        }
+    for (size_t pos = 0; pos < num_refs; pos++) {
+        index_referrer(entry, pos);
     }
-    // Insert
-    append_referrer(entry, new_referrer);
-    if (old_refs) free(old_refs);
 }
 
 /** 
@@ -121,46 +167,32 @@ static void append_referrer(weak_entry_t *entry, objc_object **new_referrer)
         }
 
         // Couldn't insert inline. Allocate out of line.
-        weak_referrer_t *new_referrers = (weak_referrer_t *)
-            calloc(WEAK_INLINE_COUNT, sizeof(weak_referrer_t));
-        // This constructed table is invalid, but grow_refs_and_insert
-        // will fix it and rehash it.
-        for (size_t i = 0; i < WEAK_INLINE_COUNT; i++) {
-            new_referrers[i] = entry->inline_referrers[i];
-        }
-        entry->referrers = new_referrers;
-        entry->num_refs = WEAK_INLINE_COUNT;
+        weak_referrer_t old_refs[WEAK_INLINE_COUNT];
+        memcpy(old_refs, entry->inline_referrers, sizeof(old_refs));
         entry->out_of_line_ness = REFERRERS_OUT_OF_LINE;
-        entry->mask = WEAK_INLINE_COUNT-1;
-        entry->max_hash_displacement = 0;
+        entry->num_refs = WEAK_INLINE_COUNT;
+        resize_refs(entry, old_refs, 8);
     }
 
     assert(entry->out_of_line());
 
-    if (entry->num_refs >= TABLE_SIZE(entry) * 3/4) {
-        return grow_refs_and_insert(entry, new_referrer);
+    if (entry->num_refs == REFS_CAPACITY(entry)) {
+        weak_referrer_t *old_refs = entry->referrers;
+        resize_refs(entry, old_refs, TABLE_SIZE(entry) * 2);
+        free(old_refs);
     }
-    size_t begin = w_hash_pointer(new_referrer) & (entry->mask);
-    size_t index = begin;
-    size_t hash_displacement = 0;
-    while (entry->referrers[index] != nil) {
-        hash_displacement++;
-        index = (index+1) & entry->mask;
-        if (index == begin) bad_weak_table(entry);
-    }
-    if (hash_displacement > entry->max_hash_displacement) {
-        entry->max_hash_displacement = hash_displacement;
-    }
-    weak_referrer_t &ref = entry->referrers[index];
-    ref = new_referrer;
-    entry->num_refs++;
+
+    size_t pos = entry->num_refs++;
+    entry->referrers[pos] = new_referrer;
+    index_referrer(entry, pos);
 }
 
 /** 
  * Remove old_referrer from set of referrers, if it's present.
  * Does not remove duplicates, because duplicates should not exist. 
- * 
- * @todo this is slow if old_referrer is not present. Is this ever the case? 
+ * The index closes the gap by shifting the referrers after it back 
+ * (no tombstones), and the last referrer in the array moves into 
+ * the removed one's place to keep the array dense.
  *
  * @param entry The entry holding the referrers.
  * @param old_referrer The referrer to remove. 
@@ -183,24 +215,40 @@ static void remove_referrer(weak_entry_t *entry, objc_object **old_referrer)
         return;
     }
 
-    size_t begin = w_hash_pointer(old_referrer) & (entry->mask);
-    size_t index = begin;
-    size_t hash_displacement = 0;
-    while (entry->referrers[index] != old_referrer) {
-        index = (index+1) & entry->mask;
-        if (index == begin) bad_weak_table(entry);
-        hash_displacement++;
-        if (hash_displacement > entry->max_hash_displacement) {
-            _objc_inform("Attempted to unregister unknown __weak variable "
-                         "at %p. This is probably incorrect use of "
-                         "objc_storeWeak() and objc_loadWeak(). "
-                         "Break on objc_weak_error to debug.\n", 
-                         old_referrer);
-            objc_weak_error();
-            return;
+    ssize_t found = find_referrer(entry, old_referrer);
+    if (found < 0) {
+        _objc_inform("Attempted to unregister unknown __weak variable "
+                     "at %p. This is probably incorrect use of "
+                     "objc_storeWeak() and objc_loadWeak(). "
+                     "Break on objc_weak_error to debug.\n", 
+                     old_referrer);
+        objc_weak_error();
+        return;
+    }
+
+    // Backward-shift deletion from the index.
+    size_t i = (size_t)found;
+    size_t pos = entry->index[i] - 1;
+    while (1) {
+        size_t next = (i+1) & entry->mask;
+        if (entry->index[next] == 0  ||  probe_distance(entry, next) == 0) {
+            break;
         }
+        entry->index[i] = entry->index[next];
+        i = next;
+    }
+    entry->index[i] = 0;
+
+    // Fill the hole in the referrers array with the last referrer.
+    size_t last = entry->num_refs - 1;
+    if (pos != last) {
+        objc_object **moved = entry->referrers[last];
+        ssize_t movedSlot = find_referrer(entry, moved);
+        if (movedSlot < 0) bad_weak_table(entry);
+        entry->index[movedSlot] = (uint32_t)(pos + 1);
+        entry->referrers[pos] = moved;
     }
-    entry->referrers[index] = nil;
+    entry->referrers[last] = nil;
     entry->num_refs--;
 }
 
@@ -476,7 +524,7 @@ weak_clear_no_lock(weak_table_t *weak_table, id referent_id)
     
     if (entry->out_of_line()) {
         referrers = entry->referrers;
-        count = TABLE_SIZE(entry);
+        count = entry->num_refs;
     } 
     else {
         referrers = entry->inline_referrers;
@@ -503,3 +551,124 @@ weak_clear_no_lock(weak_table_t *weak_table, id referent_id)
     weak_entry_remove(weak_table, entry);
 }
 
+
+// Bytes allocated for an entry's out-of-line referrers and index.
+static size_t referrers_bytes(weak_entry_t *entry)
+{
+    if (!entry->out_of_line()) return 0;
+    return REFS_CAPACITY(entry) * sizeof(weak_referrer_t) + 
+        TABLE_SIZE(entry) * sizeof(uint32_t);
+}
+
+
+/** 
+ * Measures the table and every entry in it.
+ * 
+ * @param weak_table 
+ * @param stats Filled in.
+ */
+void
+weak_table_stats_no_lock(weak_table_t *weak_table, weak_table_stats_t *stats)
+{
+    bzero(stats, sizeof(*stats));
+
+    size_t size = TABLE_SIZE(weak_table);
+    stats->entries = weak_table->num_entries;
+    stats->capacity = size;
+    stats->table_bytes = size * sizeof(weak_entry_t);
+    stats->max_displacement = weak_table->max_hash_displacement;
+
+    for (size_t i = 0; i < size; i++) {
+        weak_entry_t *entry = &weak_table->weak_entries[i];
+        if (!entry->referent) continue;
+
+        if (!entry->out_of_line()) {
+            for (size_t j = 0; j < WEAK_INLINE_COUNT; j++) {
+                if (entry->inline_referrers[j]) stats->referrers++;
+            }
+            continue;
+        }
+
+        stats->referrers += entry->num_refs;
+        stats->out_of_line_entries++;
+        stats->out_of_line_bytes += referrers_bytes(entry);
+        for (size_t j = 0; j < TABLE_SIZE(entry); j++) {
+            if (entry->index[j] == 0) continue;
+            size_t distance = probe_distance(entry, j);
+            if (distance > stats->max_referrer_displacement) {
+                stats->max_referrer_displacement = distance;
+            }
+        }
+    }
+}
+
+
+/** 
+ * Shrinks an entry's out-of-line referrers to fit, moving them 
+ * back inline if they fit there.
+ * 
+ * @return Bytes freed.
+ */
+static size_t compact_referrers(weak_entry_t *entry)
+{
+    if (!entry->out_of_line()) return 0;
+
+    size_t old_bytes = referrers_bytes(entry);
+    weak_referrer_t *old_refs = entry->referrers;
+    size_t num_refs = entry->num_refs;
+
+    if (num_refs <= WEAK_INLINE_COUNT) {
+        // Clears out_of_line_ness: inline_referrers[1] is a 
+        // disguised pointer or nil.
+        for (size_t i = 0; i < WEAK_INLINE_COUNT; i++) {
+            entry->inline_referrers[i] = i < num_refs ? old_refs[i] : nil;
+        }
+        free(old_refs);
+        return old_bytes;
+    }
+
+    size_t new_size = 8;
+    while (new_size / 4 * 3 < num_refs) new_size *= 2;
+    if (new_size >= TABLE_SIZE(entry)) return 0;
+
+    resize_refs(entry, old_refs, new_size);
+    free(old_refs);
+    return old_bytes - referrers_bytes(entry);
+}
+
+
+/** 
+ * Shrinks every over-allocated referrer set in the table, and then 
+ * the table itself, leaving it at most half full. 
+ * An empty table is freed.
+ * 
+ * @param weak_table 
+ * 
+ * @return Bytes freed.
+ */
+size_t
+weak_compact_no_lock(weak_table_t *weak_table)
+{
+    size_t freed = 0;
+    size_t old_size = TABLE_SIZE(weak_table);
+
+    for (size_t i = 0; i < old_size; i++) {
+        weak_entry_t *entry = &weak_table->weak_entries[i];
+        if (entry->referent) freed += compact_referrers(entry);
+    }
+
+    if (weak_table->num_entries == 0) {
+        if (weak_table->weak_entries) free(weak_table->weak_entries);
+        bzero(weak_table, sizeof(*weak_table));
+        return freed + old_size * sizeof(weak_entry_t);
+    }
+
+    size_t new_size = 64;
+    while (new_size / 2 < weak_table->num_entries) new_size *= 2;
+    if (new_size < old_size) {
+        weak_resize(weak_table, new_size);
+        freed += (old_size - new_size) * sizeof(weak_entry_t);
+    }
+
+    return freed;
+}